@@ -43,6 +43,8 @@
 #include "speeds.h"
 #include "version.h"
 #include "view.h"
+#include "patsolve/solverdatabase.h"
+#include "patsolve/solverparameters.h"
 
 #include "KCardTheme"
 
@@ -55,8 +57,10 @@
 #include <KSharedConfig>
 
 #include <QtCore/QCoreApplication>
+#include <QtCore/QDir>
 #include <QtCore/QMutex>
 #include <QtCore/QThread>
+#include <QtCore/QStandardPaths>
 #include <QtCore/QXmlStreamReader>
 #include <QtCore/QXmlStreamWriter>
 #include <QGraphicsSceneMouseEvent>
@@ -90,6 +94,20 @@ namespace
         return result;
     }
 
+    // The weights of patsolver --tune, for the games that have been tuned.
+    const SolverParameters * solverParameters()
+    {
+        static SolverParameters * parameters = 0;
+        if ( !parameters )
+        {
+            parameters = new SolverParameters;
+            const QString fileName = QStandardPaths::locate( QStandardPaths::DataLocation, QLatin1String( "solver-parameters" ) );
+            if ( !fileName.isEmpty() )
+                parameters->load( fileName );
+        }
+        return parameters;
+    }
+
     QString solverStatusMessage( int status, bool everWinnable )
     {
         switch ( status )
@@ -99,10 +117,12 @@ namespace
         case Solver::NoSolutionExists:
             return everWinnable ? i18n("Solver: This game is no longer winnable.")
                                 : i18n("Solver: This game cannot be won.");
+        // A Solve job has no position budget, so it only stops short of
+        // an answer when the memory runs out.
         case Solver::UnableToDetermineSolvability:
+        case Solver::MemoryLimitReached:
             return i18n("Solver: Unable to determine if this game is winnable.");
         case Solver::SearchAborted:
-        case Solver::MemoryLimitReached:
         default:
             return QString();
         }
@@ -173,34 +193,182 @@ class SolverThread : public QThread
     Q_OBJECT
 
 public:
+    // What the thread is asked to find out about the layout.
+    enum Job
+    {
+        Solve,     // search for a winning line, no matter how long it takes
+        Check,     // find out quickly whether the game is lost
+        Hint       // find the moves possible right now
+    };
+
     SolverThread( Solver * solver )
-      : m_solver( solver )
+      : m_solver( solver ),
+        m_job( Solve ),
+        m_maxPositions( -1 ),
+        m_serial( 0 )
+    {
+        qRegisterMetaType<QList<MOVE> >();
+        m_deadline.setSingleShot( true );
+        connect(&m_deadline, &QTimer::timeout, this, &SolverThread::requestAbort);
+    }
+
+    // Runs a job on the layout the solver was last given. The result
+    // arrives through finished() together with the serial, so the receiver
+    // can tell whether it still applies, and with copies of what the
+    // solver found, since the next job may be using it by then. A non-zero
+    // deadline ends the search after that many milliseconds, with
+    // Solver::SearchAborted.
+    void startJob( Job job, int maxPositions, int deadline, int serial, Priority priority )
+    {
+        m_job = job;
+        m_maxPositions = maxPositions;
+        m_serial = serial;
+        if ( deadline > 0 )
+            m_deadline.start( deadline );
+        else
+            m_deadline.stop();
+        start( priority );
+    }
+
+    Job job() const
+    {
+        return m_job;
+    }
+
+    int serial() const
     {
+        return m_serial;
     }
 
     virtual void run()
     {
-        Solver::ExitStatus result = m_solver->patsolve();
-        emit finished( result );
+        Solver::ExitStatus result = m_solver->patsolve( m_maxPositions, DEBUG_HINTS && m_job == Hint );
+        emit finished( m_job, result, m_serial, m_solver->firstMoves, m_solver->winMoves,
+                       m_solver->positionsSearched() );
     }
 
     void abort()
     {
-        {
-            QMutexLocker lock( &m_solver->endMutex );
-            m_solver->m_shouldEnd = true;
-        }
+        requestAbort();
         wait();
     }
 
+public slots:
+    // Asks the search to end, without waiting for it.
+    void requestAbort()
+    {
+        QMutexLocker lock( &m_solver->endMutex );
+        m_solver->m_shouldEnd = true;
+    }
+
 signals:
-    void finished( int result );
+    void finished( int job, int result, int serial, const QList<MOVE> & firstMoves,
+                   const QList<MOVE> & winMoves, unsigned long positions );
 
 private:
     Solver * m_solver;
+    Job m_job;
+    int m_maxPositions;
+    int m_serial;
+    QTimer m_deadline;
+};
+
+
+// Holds the solver database and saves it on a thread of its own, once no
+// new result has come in for a while, so the player never waits for the
+// disk. What is left is saved when the writer goes.
+class SolverDatabaseWriter : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit SolverDatabaseWriter( const QString & fileName )
+      : m_database( fileName ),
+        m_saveAgain( false )
+    {
+        m_delay.setSingleShot( true );
+        m_delay.setInterval( DURATION_SOLVER_DATABASE_SAVE );
+        connect(&m_delay, &QTimer::timeout, this, &SolverDatabaseWriter::startSave);
+        connect(this, &QThread::finished, this, &SolverDatabaseWriter::saveFinished);
+    }
+
+    ~SolverDatabaseWriter()
+    {
+        m_delay.stop();
+        wait();
+        m_database.save();
+    }
+
+    SolverDatabase * database()
+    {
+        return &m_database;
+    }
+
+    void scheduleSave()
+    {
+        m_delay.start();
+    }
+
+    virtual void run()
+    {
+        m_database.save();
+    }
+
+private slots:
+    void startSave()
+    {
+        if ( isRunning() )
+            m_saveAgain = true;
+        else
+            start( QThread::LowPriority );
+    }
+
+    void saveFinished()
+    {
+        if ( m_saveAgain )
+        {
+            m_saveAgain = false;
+            m_delay.start();
+        }
+    }
+
+private:
+    SolverDatabase m_database;
+    QTimer m_delay;
+    bool m_saveAgain;
 };
 
 
+namespace
+{
+    SolverDatabaseWriter * databaseWriter = 0;
+
+    void closeSolverDatabase()
+    {
+        delete databaseWriter;
+        databaseWriter = 0;
+    }
+
+    // The deals the solvers have been through before, shared by all games.
+    SolverDatabaseWriter * solverDatabaseWriter()
+    {
+        if ( !databaseWriter )
+        {
+            const QString dir = QStandardPaths::writableLocation( QStandardPaths::DataLocation );
+            QDir().mkpath( dir );
+            databaseWriter = new SolverDatabaseWriter( dir + QLatin1String( "/solver.db" ) );
+            qAddPostRoutine( closeSolverDatabase );
+        }
+        return databaseWriter;
+    }
+
+    SolverDatabase * solverDatabase()
+    {
+        return solverDatabaseWriter()->database();
+    }
+}
+
+
 int DealerScene::moveCount() const
 {
     return m_loadedMoveCount + m_undoStack.size();
@@ -538,10 +706,70 @@ bool DealerScene::loadFile( QIODevice * io )
 }
 
 
+bool DealerScene::replaySolutions( QIODevice * io, const QString & options )
+{
+    // The moves are the solver's, it turns them into cards and piles.
+    if ( !m_solver )
+    {
+        qWarning() << "There is no solver to replay the solutions with.";
+        return false;
+    }
+
+    QList<SolutionFile::Deal> deals;
+    while ( !io->atEnd() )
+    {
+        const QByteArray line = io->readLine();
+        if ( line.trimmed().isEmpty() )
+            continue;
+
+        SolutionFile::Deal deal;
+        if ( !SolutionFile::parseDealLine( line, m_solver->numberPiles(), &deal ) )
+        {
+            qWarning() << "Unrecognized solution" << line;
+            return false;
+        }
+        if ( deal.status == Solver::SolutionExists )
+            deals << deal;
+    }
+
+    if ( deals.isEmpty() )
+    {
+        qWarning() << "There is no solution to replay.";
+        return false;
+    }
+
+    setGameOptions( options );
+    m_replayQueue = deals;
+    m_replayInProgress = true;
+    replayNextSolution();
+    return true;
+}
+
+
+void DealerScene::replayNextSolution()
+{
+    // Unless the player has taken over since.
+    if ( !m_replayInProgress || m_replayQueue.isEmpty() )
+        return;
+
+    const SolutionFile::Deal deal = m_replayQueue.takeFirst();
+    startNew( deal.dealNumber );
+
+    // A replay is no game of the player.
+    m_statisticsRecorded = true;
+    m_replayMoves = deal.moves;
+    m_replayInProgress = true;
+    startDemo();
+}
+
+
 DealerScene::DealerScene( const DealerInfo * di )
   : m_di( di ),
     m_solver( 0 ),
     m_solverThread( 0 ),
+    m_replayInProgress( false ),
+    m_solverHintsValid( false ),
+    m_stateSerial( 0 ),
     m_peekedCard( 0 ),
     m_dealNumber( 0 ),
     m_loadedMoveCount( 0 ),
@@ -550,6 +778,7 @@ DealerScene::DealerScene( const DealerInfo * di )
     m_autoDropEnabled( false ),
     m_solverEnabled( false ),
     m_dealStarted( false ),
+    m_dealtFromNumber( false ),
     m_dealWasEverWinnable( false ),
     m_dealHasBeenWon( false ),
     m_dealWasJustSaved( false ),
@@ -564,6 +793,9 @@ DealerScene::DealerScene( const DealerInfo * di )
     m_demoInProgress( false ),
     m_dropInProgress( false ),
     m_hintQueued( false ),
+    m_solverHintQueued( false ),
+    m_solverDropQueued( false ),
+    m_solverDemoQueued( false ),
     m_demoQueued( false ),
     m_dropQueued( false ),
     m_newCardsQueued( false ),
@@ -666,6 +898,15 @@ void DealerScene::startHint()
         return;
     }
 
+    // Don't wait for the solver here, startHint() is called again once it
+    // has looked at the layout.
+    if ( m_solver && !m_solverHintsValid )
+    {
+        m_solverHintQueued = true;
+        requestSolverHints();
+        return;
+    }
+
     if ( isKeyboardModeActive() )
         setKeyboardModeActive( false );
 
@@ -705,24 +946,40 @@ bool DealerScene::isHintActive() const
 
 QList<MoveHint> DealerScene::getSolverHints()
 {
-    QList<MoveHint> hintList;
+    // Never wait for the solver here. Until it has looked at the layout
+    // there are no hints, whoever needs them waits for
+    // slotSolverFinished() instead, see startHint(), drop() and demo().
+    if ( !m_solverHintsValid )
+        requestSolverHints();
 
-    if ( m_solverThread && m_solverThread->isRunning() )
-        m_solverThread->abort();
+    return m_solverHints;
+}
 
-    solver()->translate_layout();
-    bool debug = false;
-#if DEBUG_HINTS
-    debug = true;
-#endif
-    solver()->patsolve( 1, debug );
 
-    foreach ( const MOVE & m, solver()->firstMoves )
-    {
-        MoveHint mh = solver()->translateMove( m );
-	hintList << mh;
-    }
-    return hintList;
+// Usually the check after the last move is about to find the hints
+// already. Only start a search if nothing else is on its way.
+void DealerScene::requestSolverHints()
+{
+    if ( !isQuickSolverJobRunning() )
+        startSolverJob( SolverThread::Hint, 1 );
+}
+
+
+void DealerScene::takeSolverHints( const QList<MOVE> & firstMoves )
+{
+    m_solverHints.clear();
+    foreach ( const MOVE & m, firstMoves )
+        m_solverHints << solver()->translateMove( m );
+    m_solverHintsValid = true;
+}
+
+
+bool DealerScene::isQuickSolverJobRunning() const
+{
+    return m_solverThread
+           && m_solverThread->isRunning()
+           && m_solverThread->job() != SolverThread::Solve
+           && m_solverThread->serial() == m_stateSerial;
 }
 
 QList<MoveHint> DealerScene::getHints()
@@ -790,9 +1047,11 @@ static bool prioSort(const MoveHint &c1, const MoveHint &c2)
 
 MoveHint DealerScene::chooseHint()
 {
-    if ( !m_winningMoves.isEmpty() )
+    // A replay has moves of its own, the solver may be busy meanwhile.
+    QList<MOVE> & winningMoves = m_replayInProgress ? m_replayMoves : m_winningMoves;
+    if ( !winningMoves.isEmpty() )
     {
-        MOVE m = m_winningMoves.takeFirst();
+        MOVE m = winningMoves.takeFirst();
         MoveHint mh = solver()->translateMove( m );
 
 #if DEBUG_HINTS
@@ -858,6 +1117,7 @@ void DealerScene::startNew( int dealNumber )
     m_dealInProgress = true;
     restart( shuffled( deck()->cards(), m_dealNumber ) );
     m_dealInProgress = false;
+    m_dealtFromNumber = true;
 
     takeState();
     update();
@@ -882,6 +1142,8 @@ void DealerScene::resetInternals()
 
     m_dealWasJustSaved = false;
     m_dealWasEverWinnable = false;
+    m_dealtFromNumber = false;
+    m_replayInProgress = false;
     m_toldAboutLostGame = false;
     m_toldAboutWonGame = false;
     m_loadedMoveCount = 0;
@@ -973,6 +1235,9 @@ void DealerScene::showWonMessage()
 
     updateWonItem();
     m_wonItem->show();
+
+    if ( m_replayInProgress )
+        QTimer::singleShot( TIME_BETWEEN_REPLAYS, this, SLOT(replayNextSolution()) );
 }
 
 void DealerScene::updateWonItem()
@@ -1171,6 +1436,7 @@ void DealerScene::undoOrRedo( bool undo )
         toStack.push( m_currentState );
         m_currentState = fromStack.pop();
         setGameState( m_currentState->stateData );
+        stateChanged();
 
         QSet<KCardPile*> pilesAffected;
         foreach ( const CardStateChange & change, changes )
@@ -1323,6 +1589,7 @@ void DealerScene::takeState()
         m_redoStack.clear();
     }
     m_currentState = new GameState( changes, getGameState() );
+    stateChanged();
 
     emit redoPossible( false );
     emit undoPossible( !m_undoStack.isEmpty() );
@@ -1335,13 +1602,19 @@ void DealerScene::takeState()
         return;
     }
 
-    if ( !m_toldAboutWonGame && !m_toldAboutLostGame && isGameLost() )
+    // With a solver the check runs in the background and gameLost() may
+    // come later, see slotSolverFinished().
+    if ( !m_toldAboutWonGame && !m_toldAboutLostGame )
     {
-        emit gameInProgress( false );
-        emit solverStateChanged( i18n( "Solver: This game is lost." ) );
-        m_toldAboutLostGame = true;
-        stopDemo();
-        return;
+        if ( m_solver )
+        {
+            startSolverJob( SolverThread::Check, neededFutureMoves() );
+        }
+        else if ( isGameLost() )
+        {
+            gameLost();
+            return;
+        }
     }
 
     if ( !isDemoActive() && !isCardAnimationRunning() && m_solver )
@@ -1357,6 +1630,24 @@ void DealerScene::takeState()
 }
 
 
+void DealerScene::gameLost()
+{
+    emit gameInProgress( false );
+    emit solverStateChanged( i18n( "Solver: This game is lost." ) );
+    m_toldAboutLostGame = true;
+    stopDemo();
+    stopDrop();
+}
+
+
+void DealerScene::stateChanged()
+{
+    ++m_stateSerial;
+    m_solverHints.clear();
+    m_solverHintsValid = false;
+}
+
+
 void DealerScene::setSolverEnabled(bool a)
 {
     m_solverEnabled = a;
@@ -1397,6 +1688,7 @@ void DealerScene::startDrop()
 
 void DealerScene::stopDrop()
 {
+    m_solverDropQueued = false;
     if ( m_dropInProgress )
     {
         m_dropTimer.stop();
@@ -1417,6 +1709,14 @@ bool DealerScene::isDropActive() const
 
 bool DealerScene::drop()
 {
+    // The drop goes on once the solver has looked at the layout.
+    if ( m_solver && !m_solverHintsValid )
+    {
+        m_solverDropQueued = true;
+        requestSolverHints();
+        return true;
+    }
+
     foreach ( const MoveHint & mh, getHints() )
     {
         if ( mh.pile()
@@ -1472,6 +1772,13 @@ void DealerScene::stopAndRestartSolver()
     if ( m_toldAboutLostGame || m_toldAboutWonGame ) // who cares?
         return;
 
+    // Let a loss check or hint search for this layout finish first.
+    if ( isQuickSolverJobRunning() )
+    {
+        startSolver();
+        return;
+    }
+
     if ( m_solverThread && m_solverThread->isRunning() )
     {
         m_solverThread->abort();
@@ -1491,23 +1798,121 @@ void DealerScene::slotSolverEnded()
     if ( m_solverThread && m_solverThread->isRunning() )
         return;
 
-    m_solver->translate_layout();
     m_winningMoves.clear();
+
+    SolverDatabase::Entry known;
+    if ( isAtDealStart()
+         && solverDatabase()->lookup( gameId(), getSolverOptions(), m_dealNumber, &known )
+         && known.isDecided() )
+    {
+        setSolverResult( known.status, known.moves );
+        return;
+    }
+
     emit solverStateChanged( i18n("Solver: Calculating...") );
+    startSolverJob( SolverThread::Solve, -1 );
+}
+
+
+void DealerScene::startSolverJob( int job, int maxPositions )
+{
+    if ( m_solverThread && m_solverThread->isRunning() )
+        m_solverThread->abort();
+
+    m_solver->translate_layout();
+    solverParameters()->apply( gameId(), getGameOptions(), m_solver );
+
+    // Only the demo plays what a Solve job finds, so only that is worth
+    // a moment to make it short. Nobody sees the lines of the quick jobs.
+    m_solver->setImprovementTime( job == SolverThread::Solve ? DURATION_SOLVER_IMPROVE : 0 );
     if ( !m_solverThread )
     {
         m_solverThread = new SolverThread( m_solver );
         connect(m_solverThread, &SolverThread::finished, this, &DealerScene::slotSolverFinished);
     }
-    m_solverThread->start( m_solverEnabled ? QThread::IdlePriority : QThread::NormalPriority );
+
+    // The quick jobs answer the player, so they get a deadline instead of
+    // a low priority.
+    if ( job == SolverThread::Solve )
+        m_solverThread->startJob( SolverThread::Solve, maxPositions, 0, m_stateSerial,
+                                  m_solverEnabled ? QThread::IdlePriority : QThread::NormalPriority );
+    else
+        m_solverThread->startJob( SolverThread::Job( job ), maxPositions, DURATION_SOLVER_DEADLINE,
+                                  m_stateSerial, QThread::NormalPriority );
 }
 
 
-void DealerScene::slotSolverFinished( int result )
+void DealerScene::slotSolverFinished( int job, int result, int serial, const QList<MOVE> & firstMoves,
+                                      const QList<MOVE> & winMoves, unsigned long positions )
+{
+    // The player has moved on since.
+    if ( serial != m_stateSerial )
+        return;
+
+    if ( job != SolverThread::Solve )
+    {
+        if ( !m_solverHintsValid )
+            takeSolverHints( firstMoves );
+
+        if ( job == SolverThread::Check
+             && result == Solver::NoSolutionExists
+             && !m_toldAboutWonGame && !m_toldAboutLostGame )
+        {
+            gameLost();
+        }
+
+        // What waited for the hints goes on now.
+        if ( m_solverHintQueued )
+        {
+            m_solverHintQueued = false;
+            startHint();
+        }
+        if ( m_solverDropQueued )
+        {
+            m_solverDropQueued = false;
+            if ( m_dropInProgress && !isCardAnimationRunning() )
+                drop();
+        }
+        if ( m_solverDemoQueued )
+        {
+            m_solverDemoQueued = false;
+            if ( m_demoInProgress )
+                demo();
+        }
+        return;
+    }
+
+    if ( ( result == Solver::SolutionExists || result == Solver::NoSolutionExists )
+         && isAtDealStart() )
+    {
+        SolverDatabase::Entry entry;
+        entry.status = result;
+        entry.positions = positions;
+        entry.moves = winMoves;
+        solverDatabase()->insert( gameId(), getSolverOptions(), m_dealNumber, entry );
+        solverDatabaseWriter()->scheduleSave();
+    }
+
+    setSolverResult( result, winMoves );
+
+    if ( result == Solver::SearchAborted )
+        startSolver();
+}
+
+
+// Whether the cards are still as startNew() dealt them, so the layout
+// is the one of the deal number.
+bool DealerScene::isAtDealStart() const
+{
+    return m_dealtFromNumber && moveCount() == 0;
+}
+
+
+void DealerScene::setSolverResult( int result, const QList<MOVE> & winMoves )
 {
     if ( result == Solver::SolutionExists )
     {
-        m_winningMoves = m_solver->winMoves;
+        m_winningMoves = winMoves;
         m_dealWasEverWinnable = true;
     }
 
@@ -1518,9 +1923,6 @@ void DealerScene::slotSolverFinished( int result )
         m_currentState->solvability = static_cast<Solver::ExitStatus>( result );
         m_currentState->winningMoves = m_winningMoves;
     }
-
-    if ( result == Solver::SearchAborted )
-        startSolver();
 }
 
 
@@ -1606,6 +2008,7 @@ void DealerScene::startDemo()
 
 void DealerScene::stopDemo()
 {
+    m_solverDemoQueued = false;
     if ( m_demoInProgress )
     {
         m_demoTimer.stop();
@@ -1629,6 +2032,13 @@ void DealerScene::demo()
         return;
     }
 
+    // Had the solution won, won() would have ended the demo.
+    if ( m_replayInProgress && m_replayMoves.isEmpty() )
+    {
+        stopReplay( i18n("Replay: The solution of deal %1 does not win.", m_dealNumber) );
+        return;
+    }
+
     m_demoInProgress = true;
     m_playerReceivedHelp = true;
     m_dealStarted = true;
@@ -1636,7 +2046,30 @@ void DealerScene::demo()
 
     m_demoTimer.stop();
 
+    // Without a line to follow, the demo goes on once the solver has
+    // looked at the layout.
+    const QList<MOVE> & winningMoves = m_replayInProgress ? m_replayMoves : m_winningMoves;
+    if ( m_solver && !m_solverHintsValid && winningMoves.isEmpty() )
+    {
+        m_solverDemoQueued = true;
+        requestSolverHints();
+        emit demoActive( true );
+        return;
+    }
+
     MoveHint mh = chooseHint();
+
+    // The moves of a replay come from a file, so they are checked like the
+    // player's before they are played.
+    if ( m_replayInProgress && mh.isValid()
+         && ( mh.pile() == mh.card()->pile()
+              || !allowedToRemove( mh.card()->pile(), mh.card() )
+              || !allowedToAdd( mh.pile(), mh.card()->pile()->topCardsDownTo( mh.card() ) ) ) )
+    {
+        stopReplay( i18n("Replay: The solution of deal %1 makes a move that is not allowed.", m_dealNumber) );
+        return;
+    }
+
     if ( mh.isValid() )
     {
         KCard * card = mh.card();
@@ -1674,6 +2107,10 @@ void DealerScene::demo()
         {
             won();
         }
+        else if ( m_replayInProgress )
+        {
+            stopReplay( i18n("Replay: The solution of deal %1 makes a move that is not allowed.", m_dealNumber) );
+        }
         else
         {
             stopDemo();
@@ -1687,6 +2124,15 @@ void DealerScene::demo()
 }
 
 
+void DealerScene::stopReplay( const QString & message )
+{
+    stopDemo();
+    m_replayInProgress = false;
+    m_replayQueue.clear();
+    emit solverStateChanged( message );
+}
+
+
 void DealerScene::drawDealRowOrRedeal()
 {
     stop();
@@ -1713,6 +2159,10 @@ void DealerScene::setSolver( Solver *s) {
     delete m_solverThread;
     m_solver = s;
     m_solverThread = 0;
+
+    // The solver runs after every move, let it build on the last run.
+    if ( m_solver )
+        m_solver->setRetainSearch( true );
 }
 
 bool DealerScene::isGameWon() const
@@ -1952,6 +2402,12 @@ void DealerScene::setGameOptions( const QString & options )
 }
 
 
+QString DealerScene::getSolverOptions() const
+{
+    return getGameOptions();
+}
+
+
 bool DealerScene::allowedToStartNewGame()
 {
     // Check if the user is already running a game, and if she is,
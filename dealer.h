@@ -49,6 +49,7 @@ class SolverThread;
 #include "speeds.h"
 #include "view.h"
 #include "patsolve/patsolve.h"
+#include "patsolve/solutionfile.h"
 
 #include "KCardDeck"
 #include "KCardScene"
@@ -56,10 +57,14 @@ class SolverThread;
 
 class QAction;
 #include <QtCore/QMap>
+#include <QtCore/QMetaType>
 #include <QtCore/QStack>
 #include <QtCore/QTimer>
 class QDomDocument;
 
+// The solver thread hands its moves over in signals.
+Q_DECLARE_METATYPE( MOVE )
+
 
 class DealerScene : public KCardScene
 {
@@ -119,6 +124,9 @@ public:
     bool loadFile( QIODevice * io );
     void saveLegacyFile( QIODevice * io );
     bool loadLegacyFile( QIODevice * io );
+    // Plays the won deals of a solution file of this game one after the
+    // other, see SolutionFile.  io is past the header line.
+    bool replaySolutions( QIODevice * io, const QString & options );
     
     virtual void mapOldId(int id);
     virtual int oldId() const;
@@ -181,6 +189,10 @@ protected:
     virtual QString getGameOptions() const;
     virtual void setGameOptions( const QString & options );
 
+    // reimplement this if the outcome of a deal also depends on settings
+    // that aren't game options, it keys the deals in the solver database
+    virtual QString getSolverOptions() const;
+
     void addCardForDeal( KCardPile * pile, KCard * card, bool faceUp, QPointF startPos );
     void startDealAnimation();
 
@@ -207,7 +219,9 @@ protected slots:
 private slots:
     void stopAndRestartSolver();
     void slotSolverEnded();
-    void slotSolverFinished( int result );
+    void slotSolverFinished( int job, int result, int serial, const QList<MOVE> & firstMoves,
+                             const QList<MOVE> & winMoves, unsigned long positions );
+    void replayNextSolution();
 
     void demo();
 
@@ -221,6 +235,17 @@ private:
     MoveHint chooseHint();
 
     void won();
+    void gameLost();
+    void stopReplay( const QString & message );
+    void stateChanged();
+
+    // job is a SolverThread::Job.
+    void startSolverJob( int job, int maxPositions );
+    bool isQuickSolverJobRunning() const;
+    void requestSolverHints();
+    void takeSolverHints( const QList<MOVE> & firstMoves );
+    bool isAtDealStart() const;
+    void setSolverResult( int result, const QList<MOVE> & winMoves );
 
     int speedUpTime( int delay ) const;
 
@@ -235,6 +260,12 @@ private:
     Solver * m_solver;
     SolverThread * m_solverThread;
     QList<MOVE> m_winningMoves;
+    QList<SolutionFile::Deal> m_replayQueue;
+    QList<MOVE> m_replayMoves;
+    bool m_replayInProgress;
+    QList<MoveHint> m_solverHints;
+    bool m_solverHintsValid;
+    int m_stateSerial;
 
     KCard * m_peekedCard;
     MessageBox * m_wonItem;
@@ -252,6 +283,7 @@ private:
     bool m_solverEnabled;
 
     bool m_dealStarted;
+    bool m_dealtFromNumber;
     bool m_dealWasEverWinnable;
     bool m_dealHasBeenWon;
     bool m_dealWasJustSaved;
@@ -273,6 +305,9 @@ private:
     bool m_dropInProgress;
 
     bool m_hintQueued;
+    bool m_solverHintQueued;
+    bool m_solverDropQueued;
+    bool m_solverDemoQueued;
     bool m_demoQueued;
     bool m_dropQueued;
     bool m_newCardsQueued;
@@ -38,7 +38,11 @@
 #include "dealerinfo.h"
 #include "mainwindow.h"
 #include "version.h"
+#include "patsolve/batchsolver.h"
+#include "patsolve/benchmark.h"
 #include "patsolve/patsolve.h"
+#include "patsolve/solverdatabase.h"
+#include "patsolve/solverfactory.h"
 
 #include "KCardTheme"
 #include "KCardDeck"
@@ -192,9 +196,15 @@ int main( int argc, char **argv )
     parser.addOption(QCommandLineOption(QStringList() << QLatin1String("solve"), i18n("Dealer to solve (debug)" ), QLatin1String("num")));
     parser.addOption(QCommandLineOption(QStringList() << QLatin1String("start"), i18n("Game range start (default 0:INT_MAX)" ), QLatin1String("num")));
     parser.addOption(QCommandLineOption(QStringList() << QLatin1String("end"), i18n("Game range end (default start:start if start given)" ), QLatin1String("num")));
+    parser.addOption(QCommandLineOption(QStringList() << QLatin1String("jobs"), i18n("Number of deals to solve in parallel (default 1)" ), QLatin1String("num")));
+    parser.addOption(QCommandLineOption(QStringList() << QLatin1String("database"), i18n("Solver database to take known deals from and to add the others to" ), QLatin1String("file")));
+    parser.addOption(QCommandLineOption(QStringList() << QLatin1String("solutions"), i18n("Write the solutions found to a file that can be loaded to replay them" ), QLatin1String("file")));
     parser.addOption(QCommandLineOption(QStringList() << QLatin1String("gametype"), i18n("Skip the selection screen and load a particular game type. Valid values are: %1",gameList.join(listSeparator)), QLatin1String("game")));
     parser.addOption(QCommandLineOption(QStringList() << QLatin1String("testdir"), i18n( "Directory with test cases" ), QLatin1String("directory")));
     parser.addOption(QCommandLineOption(QStringList() << QLatin1String("generate"), i18n( "Generate random test cases" )));
+    parser.addOption(QCommandLineOption(QStringList() << QLatin1String("results"), i18n( "Write the results of the test cases to a file" ), QLatin1String("file")));
+    parser.addOption(QCommandLineOption(QStringList() << QLatin1String("baseline"), i18n( "Fail if the test cases got slower or changed their verdict since the results in this file" ), QLatin1String("file")));
+    parser.addOption(QCommandLineOption(QStringList() << QLatin1String("threshold"), i18n( "Percentage a game may get slower than the baseline (default 20)" ), QLatin1String("percent")));
     parser.addPositionalArgument(QLatin1String("file"), i18n("File to load"));
 
     aboutData.setupCommandLine(&parser);
@@ -260,8 +270,22 @@ int main( int argc, char **argv )
                 }
              }
           }
-       } 
-       return 0;
+          return 0;
+       }
+
+       SolverBenchmark benchmark( testdir );
+       if ( parser.isSet( "jobs" ) )
+           benchmark.setJobs( parser.value("jobs").toInt() );
+       if ( parser.isSet( "results" ) )
+           benchmark.setResultsFile( parser.value("results") );
+       if ( parser.isSet( "baseline" ) )
+       {
+           int threshold = 20;
+           if ( parser.isSet( "threshold" ) )
+               threshold = qMax( 0, parser.value("threshold").toInt() );
+           benchmark.setBaseline( parser.value("baseline"), threshold );
+       }
+       return benchmark.run() == 0 ? 0 : 1;
     }
 
     bool ok = false;
@@ -287,26 +311,43 @@ int main( int argc, char **argv )
             if ( end_index == -1 )
                 end_index = start_index;
         }
-        DealerScene *f = getDealer( wanted_game );
-        if ( !f )
-            return 1;
+        int jobs = 1;
+        if ( parser.isSet( "jobs" ) )
+            jobs = qMax( 1, parser.value("jobs").toInt() );
+
+        // No need for a scene here, the solvers deal the games themselves.
+        QList<Solver*> solvers;
+        for ( int i = 0; i < jobs; ++i )
+        {
+            Solver *solver = createSolver( wanted_game );
+            if ( !solver )
+            {
+                qCritical() << "There is no solver for game" << wanted_game;
+                return 1;
+            }
+            // The solutions may be written out and replayed, see
+            // DealerScene::replaySolutions().
+            solver->setImprovementTime( DURATION_SOLVER_IMPROVE );
+            solvers << solver;
+        }
+
+        BatchSolver batch( solvers, start_index, end_index );
+        int baseId;
+        QString options;
+        solverDatabaseKey( wanted_game, &baseId, &options );
+        batch.setGame( baseId, options );
 
-        QTime mytime;
-        for ( int i = start_index; i <= end_index; i++ )
+        SolverDatabase *database = 0;
+        if ( parser.isSet( "database" ) )
         {
-            mytime.start();
-            f->deck()->stopAnimations();
-            f->startNew( i );
-            f->solver()->translate_layout();
-            int ret = f->solver()->patsolve();
-            if ( ret == Solver::SolutionExists )
-                fprintf( stdout, "%d won (%d ms)\n", i, mytime.elapsed() );
-            else if ( ret == Solver::NoSolutionExists )
-                fprintf( stdout, "%d lost (%d ms)\n", i, mytime.elapsed()  );
-            else
-                fprintf( stdout, "%d unknown (%d ms)\n", i, mytime.elapsed() );
+            database = new SolverDatabase( parser.value( "database" ) );
+            batch.setDatabase( database );
         }
-        fprintf( stdout, "all_moves %ld\n", all_moves );
+        if ( parser.isSet( "solutions" ) )
+            batch.setSolutionFile( parser.value( "solutions" ) );
+        batch.run();
+        delete database;
+        qDeleteAll( solvers );
         return 0;
     }
 
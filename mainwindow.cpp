@@ -42,6 +42,7 @@
 #include "dealerinfo.h"
 #include "gameselectionscene.h"
 #include "numbereddealdialog.h"
+#include "patsolve/solutionfile.h"
 #include "renderer.h"
 #include "settings.h"
 #include "soundengine.h"
@@ -852,18 +853,28 @@ bool MainWindow::loadGame( const QUrl & url, bool addToRecentFiles )
         return false;
     }
 
+    // The solutions of kpat --solve and patsolver are text, not XML.
+    int gameId = -1;
+    QString solutionOptions;
+    const bool isSolutionFile = SolutionFile::parseHeader( file.readLine(), &gameId, &solutionOptions );
+    if ( !isSolutionFile )
+        file.reset();
+
     QXmlStreamReader xml( &file );
-    if ( !xml.readNextStartElement() )
+    if ( !isSolutionFile && !xml.readNextStartElement() )
     {
         KMessageBox::error( this, i18n("Error reading XML file: ") + xml.errorString() );
         KIO::NetAccess::removeTempFile( fileName );
         return false;
     }
 
-    int gameId = -1;
-    bool isLegacyFile;
+    bool isLegacyFile = false;
 
-    if ( xml.name() == "dealer" )
+    if ( isSolutionFile )
+    {
+        // The game id is known already.
+    }
+    else if ( xml.name() == "dealer" )
     {
         isLegacyFile = true;
         bool ok;
@@ -908,11 +919,19 @@ bool MainWindow::loadGame( const QUrl & url, bool addToRecentFiles )
 
     setGameType( gameId );
 
-    xml.clear();
-    file.reset();
+    bool success;
+    if ( isSolutionFile )
+    {
+        success = m_dealer->replaySolutions( &file, solutionOptions );
+    }
+    else
+    {
+        xml.clear();
+        file.reset();
 
-    bool success = isLegacyFile ? m_dealer->loadLegacyFile( &file )
-                                : m_dealer->loadFile( &file );
+        success = isLegacyFile ? m_dealer->loadLegacyFile( &file )
+                               : m_dealer->loadFile( &file );
+    }
 
     file.close();
     KIO::NetAccess::removeTempFile( fileName );
@@ -0,0 +1,294 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "batchsolver.h"
+
+#include "solutionfile.h"
+#include "solverdatabase.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QThread>
+
+#include <cstdio>
+
+
+static QJsonObject statsToJson( const SolverStats & stats )
+{
+    QJsonArray queued;
+    foreach ( int count, stats.queued )
+        queued.append( count );
+
+    QJsonObject object;
+    object.insert( QStringLiteral( "generated" ), double( stats.generated ) );
+    object.insert( QStringLiteral( "positions" ), double( stats.positions ) );
+    object.insert( QStringLiteral( "clusters" ), stats.clusters );
+    object.insert( QStringLiteral( "maxDepth" ), stats.maxDepth );
+    object.insert( QStringLiteral( "piles" ), stats.piles );
+    object.insert( QStringLiteral( "deadEnds" ), double( stats.deadEnds ) );
+    object.insert( QStringLiteral( "memoryUsed" ), double( stats.memoryUsed ) );
+    object.insert( QStringLiteral( "memoryPeak" ), double( stats.memoryPeak ) );
+    object.insert( QStringLiteral( "queued" ), queued );
+    object.insert( QStringLiteral( "setupMsecs" ), double( stats.setupMsecs ) );
+    object.insert( QStringLiteral( "searchMsecs" ), double( stats.searchMsecs ) );
+    object.insert( QStringLiteral( "cleanupMsecs" ), double( stats.cleanupMsecs ) );
+    return object;
+}
+
+
+class BatchSolverThread : public QThread
+{
+public:
+    BatchSolverThread( BatchSolver * batch, Solver * solver )
+      : m_batch( batch ),
+        m_solver( solver )
+    {
+    }
+
+    virtual void run()
+    {
+        int dealNumber;
+        while ( m_batch->nextDeal( &dealNumber ) )
+        {
+            QElapsedTimer timer;
+            timer.start();
+
+            BatchSolver::Result result;
+            SolverDatabase * database = m_batch->m_database;
+            SolverDatabase::Entry known;
+            if ( database
+                 && database->lookup( m_batch->m_gameId, m_batch->m_options, dealNumber, &known )
+                 && known.isDecided() )
+            {
+                result.status = known.status;
+                result.msecs = timer.elapsed();
+                result.positions = 0;
+                result.peakBytes = 0;
+                result.known = true;
+                result.moves = known.moves;
+                if ( !m_batch->m_statsFile.isEmpty() )
+                {
+                    // What the search that found the answer went through.
+                    result.stats.insert( QStringLiteral( "known" ), true );
+                    result.stats.insert( QStringLiteral( "positions" ), double( known.positions ) );
+                    if ( result.status == Solver::SolutionExists )
+                        result.stats.insert( QStringLiteral( "moves" ), known.moves.count() );
+                }
+                m_batch->reportResult( dealNumber, result );
+                continue;
+            }
+
+            m_solver->deal_layout( dealNumber );
+
+            result.status = m_solver->patsolve( -1, false, m_batch->m_searchThreads );
+            result.msecs = timer.elapsed();
+            result.positions = m_solver->positionsSearched();
+            result.peakBytes = m_solver->peakMemory();
+            result.known = false;
+            if ( result.status == Solver::SolutionExists )
+                result.moves = m_solver->winMoves;
+            if ( !m_batch->m_statsFile.isEmpty() )
+            {
+                result.stats = statsToJson( m_solver->stats() );
+                if ( result.status == Solver::SolutionExists )
+                    result.stats.insert( QStringLiteral( "moves" ), m_solver->winMoves.count() );
+            }
+            if ( database )
+            {
+                SolverDatabase::Entry entry;
+                entry.status = result.status;
+                entry.positions = result.positions;
+                entry.moves = result.moves;
+                database->insert( m_batch->m_gameId, m_batch->m_options, dealNumber, entry );
+            }
+            m_batch->reportResult( dealNumber, result );
+        }
+    }
+
+private:
+    BatchSolver * m_batch;
+    Solver * m_solver;
+};
+
+
+BatchSolver::BatchSolver( const QList<Solver*> & solvers, int start, int end )
+  : m_solvers( solvers ),
+    m_start( start ),
+    m_end( end ),
+    m_searchThreads( 1 ),
+    m_gameId( -1 ),
+    m_database( 0 ),
+    m_cursor( start ),
+    m_nextToPrint( start ),
+    m_dealsSolved( 0 ),
+    m_dealsKnown( 0 ),
+    m_totalPositions( 0 ),
+    m_peakBytes( 0 )
+{
+    foreach ( Solver * solver, m_solvers )
+        m_threads << new BatchSolverThread( this, solver );
+}
+
+
+BatchSolver::~BatchSolver()
+{
+    foreach ( BatchSolverThread * thread, m_threads )
+        thread->wait();
+    qDeleteAll( m_threads );
+}
+
+
+void BatchSolver::setGame( int gameId, const QString & options )
+{
+    m_gameId = gameId;
+    m_options = options;
+}
+
+
+void BatchSolver::run()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    if ( !m_solutionFileName.isEmpty() )
+    {
+        m_solutionFile.setFileName( m_solutionFileName );
+        if ( m_solutionFile.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+            m_solutionFile.write( SolutionFile::header( m_gameId, m_options ) );
+        else
+            fprintf( stderr, "Can't write %s\n", qPrintable( m_solutionFileName ) );
+    }
+
+    foreach ( BatchSolverThread * thread, m_threads )
+        thread->start();
+    foreach ( BatchSolverThread * thread, m_threads )
+        thread->wait();
+    m_solutionFile.close();
+
+    const qint64 msecs = qMax<qint64>( timer.elapsed(), 1 );
+    long allMoves = 0;
+    foreach ( Solver * solver, m_solvers )
+        allMoves += solver->all_moves;
+
+    fprintf( stdout, "all_moves %ld\n", allMoves );
+    fprintf( stdout, "%lld deals with %d jobs in %lld ms: %.1f deals/s, %.0f positions/s\n",
+             m_dealsSolved, m_threads.size(), msecs,
+             m_dealsSolved * 1000.0 / msecs, m_totalPositions * 1000.0 / msecs );
+    fprintf( stdout, "peak memory of a search: %lu KB\n", ( unsigned long )( m_peakBytes / 1024 ) );
+
+    if ( m_database )
+    {
+        fprintf( stdout, "%lld deals known from %s\n", m_dealsKnown, qPrintable( m_database->fileName() ) );
+        m_database->save();
+    }
+
+    if ( !m_statsFile.isEmpty() )
+        writeStats( msecs );
+}
+
+
+void BatchSolver::writeStats( qint64 msecs )
+{
+    QJsonArray deals;
+    foreach ( const QJsonObject & stats, m_stats )
+        deals.append( stats );
+
+    QJsonObject root;
+    root.insert( QStringLiteral( "start" ), m_start );
+    root.insert( QStringLiteral( "end" ), m_end );
+    root.insert( QStringLiteral( "jobs" ), m_threads.size() );
+    root.insert( QStringLiteral( "threads" ), m_searchThreads );
+    root.insert( QStringLiteral( "msecs" ), double( msecs ) );
+    root.insert( QStringLiteral( "deals" ), deals );
+
+    QFile file( m_statsFile );
+    if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+    {
+        fprintf( stderr, "Can't write %s\n", qPrintable( m_statsFile ) );
+        return;
+    }
+    file.write( QJsonDocument( root ).toJson() );
+}
+
+
+/* Hands out the next deal number, or returns false once the range is
+   exhausted.  Lock free, so a worker never waits for another one here. */
+bool BatchSolver::nextDeal( int * dealNumber )
+{
+    forever
+    {
+        const int deal = m_cursor.load();
+        if ( deal < m_start || deal > m_end )
+            return false;
+
+        // Park the cursor below the range instead of overflowing past INT_MAX.
+        const int next = deal == m_end ? m_start - 1 : deal + 1;
+        if ( m_cursor.testAndSetOrdered( deal, next ) )
+        {
+            *dealNumber = deal;
+            return true;
+        }
+    }
+}
+
+
+void BatchSolver::reportResult( int dealNumber, const Result & result )
+{
+    QMutexLocker lock( &m_resultMutex );
+
+    m_pending.insert( dealNumber, result );
+    ++m_dealsSolved;
+    if ( result.known )
+        ++m_dealsKnown;
+
+    if ( !m_statsFile.isEmpty() )
+    {
+        QJsonObject stats = result.stats;
+        stats.insert( QStringLiteral( "deal" ), dealNumber );
+        stats.insert( QStringLiteral( "status" ), result.status );
+        stats.insert( QStringLiteral( "msecs" ), result.msecs );
+        m_stats.insert( dealNumber, stats );
+    }
+    m_totalPositions += result.positions;
+    m_peakBytes = qMax( m_peakBytes, result.peakBytes );
+
+    // Stream out everything that is now contiguous from the last printed deal.
+    while ( m_nextToPrint <= m_end && m_pending.contains( m_nextToPrint ) )
+    {
+        const int deal = m_nextToPrint;
+        const Result r = m_pending.take( deal );
+        if ( r.known )
+            fprintf( stdout, "%d %s (known)\n", deal, r.status == Solver::SolutionExists ? "won" : "lost" );
+        else if ( r.status == Solver::SolutionExists )
+            fprintf( stdout, "%d won (%d ms)\n", deal, r.msecs );
+        else if ( r.status == Solver::NoSolutionExists )
+            fprintf( stdout, "%d lost (%d ms)\n", deal, r.msecs );
+        else
+            fprintf( stdout, "%d unknown (%d ms)\n", deal, r.msecs );
+        if ( m_solutionFile.isOpen() )
+        {
+            SolutionFile::Deal solution;
+            solution.dealNumber = deal;
+            solution.status = r.status;
+            solution.moves = r.moves;
+            m_solutionFile.write( SolutionFile::dealLine( solution ) );
+            m_solutionFile.flush();
+        }
+        ++m_nextToPrint;
+    }
+    fflush( stdout );
+}
@@ -0,0 +1,108 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BATCHSOLVER_H
+#define BATCHSOLVER_H
+
+class SolverDatabase;
+class BatchSolverThread;
+
+#include "patsolve.h"
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QFile>
+#include <QtCore/QJsonObject>
+#include <QtCore/QList>
+#include <QtCore/QMap>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+
+
+/* Solves a range of deal numbers with one worker thread per solver.  The
+   workers deal the games themselves through Solver::deal_layout() and pull
+   deal numbers from a shared atomic cursor, so a worker stuck on a hard deal
+   never holds back the others.  Results are printed in deal order
+   regardless of which worker finished first. */
+class BatchSolver
+{
+public:
+    BatchSolver( const QList<Solver*> & solvers, int start, int end );
+    ~BatchSolver();
+
+    /* Runs the whole range and returns when all workers are done. */
+    void run();
+
+    /* Search every deal with this many threads, see Solver::patsolve(). */
+    void setSearchThreads( int threads ) { m_searchThreads = threads; }
+
+    /* Also write the statistics of every search to this file as JSON. */
+    void setStatsFile( const QString & fileName ) { m_statsFile = fileName; }
+
+    /* The game as a scene names it, see solverDatabaseKey().  Needed by
+       setDatabase() and setSolutionFile(). */
+    void setGame( int gameId, const QString & options );
+
+    /* Take the deals that database knows to be won or lost from there
+       instead of searching them, and record the outcome of the others in
+       it.  The database is saved at the end of run(). */
+    void setDatabase( SolverDatabase * database ) { m_database = database; }
+
+    /* Also write every deal to this file as it is done, see SolutionFile. */
+    void setSolutionFile( const QString & fileName ) { m_solutionFileName = fileName; }
+
+private:
+    struct Result
+    {
+        int status;
+        int msecs;
+        unsigned long positions;
+        size_t peakBytes;
+        bool known;
+        QList<MOVE> moves;
+        QJsonObject stats;
+    };
+
+    void writeStats( qint64 msecs );
+
+    bool nextDeal( int * dealNumber );
+    void reportResult( int dealNumber, const Result & result );
+
+    QList<Solver*> m_solvers;
+    QList<BatchSolverThread*> m_threads;
+    int m_start;
+    int m_end;
+    int m_searchThreads;
+    QString m_statsFile;
+    int m_gameId;
+    QString m_options;
+    SolverDatabase * m_database;
+    QString m_solutionFileName;
+    QFile m_solutionFile;
+
+    QAtomicInt m_cursor;
+
+    QMutex m_resultMutex;
+    QMap<int,Result> m_pending;
+    qint64 m_nextToPrint;
+    qint64 m_dealsSolved;
+    qint64 m_dealsKnown;
+    qint64 m_totalPositions;
+    size_t m_peakBytes;
+    QMap<int,QJsonObject> m_stats;
+
+    friend class BatchSolverThread;
+};
+
+#endif // BATCHSOLVER_H
@@ -0,0 +1,365 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "benchmark.h"
+
+#include "patsolve.h"
+#include "solverfactory.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QMap>
+#include <QtCore/QPair>
+#include <QtCore/QStringList>
+#include <QtCore/QThread>
+
+#include <algorithm>
+#include <cstdio>
+
+
+/* A game only regresses if its latency grew by this much as well. */
+static const qint64 LATENCY_SLACK = 10;
+
+
+class SolverBenchmarkThread : public QThread
+{
+public:
+    SolverBenchmarkThread( SolverBenchmark * benchmark )
+      : m_benchmark( benchmark )
+    {
+    }
+
+    ~SolverBenchmarkThread()
+    {
+        qDeleteAll( m_solvers );
+    }
+
+    virtual void run()
+    {
+        SolverBenchmark::Case *cases = m_benchmark->m_cases.data();
+        int index;
+        while ( m_benchmark->nextCase( &index ) )
+        {
+            SolverBenchmark::Case & c = cases[index];
+
+            Solver *solver = m_solvers.value( c.gameId );
+            if ( !solver )
+            {
+                solver = createSolver( c.gameId );
+                m_solvers.insert( c.gameId, solver );
+            }
+
+            QElapsedTimer timer;
+            timer.start();
+            solver->deal_layout( c.dealNumber );
+            c.status = solver->patsolve();
+            c.msecs = timer.elapsed();
+            c.positions = solver->positionsSearched();
+        }
+    }
+
+private:
+    SolverBenchmark * m_benchmark;
+    QMap<int,Solver*> m_solvers;
+};
+
+
+SolverBenchmark::SolverBenchmark( const QString & directory )
+  : m_directory( directory ),
+    m_jobs( 1 ),
+    m_threshold( 0 ),
+    m_cursor( 0 )
+{
+}
+
+
+SolverBenchmark::~SolverBenchmark()
+{
+}
+
+
+void SolverBenchmark::setBaseline( const QString & fileName, int percent )
+{
+    m_baselineFile = fileName;
+    m_threshold = percent;
+}
+
+
+/* Collects the cases of the directory, in the order of game and deal so
+   that the results of two runs line up. */
+
+bool SolverBenchmark::readCases()
+{
+    QDir dir( m_directory );
+    if ( !dir.exists() )
+    {
+        fprintf( stderr, "There is no directory %s\n", qPrintable( m_directory ) );
+        return false;
+    }
+
+    QMap<QPair<int,int>,Case> cases;
+    QHash<int,bool> solvable;
+    foreach ( const QString & name, dir.entryList( QDir::Files ) )
+    {
+        const QStringList parts = name.split( QLatin1Char( '-' ) );
+        bool ok[3] = { false, false, false };
+        if ( parts.size() == 3 )
+        {
+            Case c;
+            c.gameId = parts.at( 0 ).toInt( &ok[0] );
+            // --generate deals 0 as 1, see DealerScene::startNew().
+            c.dealNumber = qMax( 1, parts.at( 1 ).toInt( &ok[1] ) );
+            c.expected = parts.at( 2 ).toInt( &ok[2] );
+            c.status = Solver::UnableToDetermineSolvability;
+            c.msecs = 0;
+            c.positions = 0;
+
+            if ( ok[0] && ok[1] && ok[2]
+                 && ( c.expected == Solver::SolutionExists || c.expected == Solver::NoSolutionExists ) )
+            {
+                if ( !solvable.contains( c.gameId ) )
+                {
+                    Solver *solver = createSolver( c.gameId );
+                    solvable.insert( c.gameId, solver != 0 );
+                    delete solver;
+                }
+
+                if ( solvable.value( c.gameId ) )
+                    cases.insert( qMakePair( c.gameId, c.dealNumber ), c );
+                else
+                    fprintf( stderr, "Skipping %s, game %d has no solver\n", qPrintable( name ), c.gameId );
+                continue;
+            }
+        }
+        fprintf( stderr, "Skipping %s, it is no test case\n", qPrintable( name ) );
+    }
+
+    m_cases.clear();
+    foreach ( const Case & c, cases )
+        m_cases.append( c );
+    return !m_cases.isEmpty();
+}
+
+
+bool SolverBenchmark::nextCase( int * index )
+{
+    const int next = m_cursor.fetchAndAddOrdered( 1 );
+    if ( next >= m_cases.size() )
+        return false;
+    *index = next;
+    return true;
+}
+
+
+static qint64 percentile( const QList<qint64> & sorted, int percent )
+{
+    // Nearest rank.
+    const int rank = ( sorted.size() * percent + 99 ) / 100;
+    return sorted.at( qBound( 0, rank - 1, sorted.size() - 1 ) );
+}
+
+
+QList<SolverBenchmark::GameResult> SolverBenchmark::gameResults() const
+{
+    QMap<int,QList<qint64> > msecs;
+    QMap<int,GameResult> games;
+    QMap<int,double> positions;
+
+    foreach ( const Case & c, m_cases )
+    {
+        if ( !games.contains( c.gameId ) )
+        {
+            GameResult game;
+            game.gameId = c.gameId;
+            game.cases = 0;
+            game.wrong = 0;
+            games.insert( c.gameId, game );
+        }
+
+        GameResult & game = games[c.gameId];
+        ++game.cases;
+        if ( c.status != c.expected )
+            ++game.wrong;
+        msecs[c.gameId].append( c.msecs );
+        positions[c.gameId] += c.positions;
+    }
+
+    QList<GameResult> result;
+    foreach ( GameResult game, games )
+    {
+        QList<qint64> sorted = msecs.value( game.gameId );
+        std::sort( sorted.begin(), sorted.end() );
+
+        qint64 total = 0;
+        foreach ( qint64 m, sorted )
+            total += m;
+
+        game.p50 = percentile( sorted, 50 );
+        game.p95 = percentile( sorted, 95 );
+        game.max = sorted.last();
+        game.positionsPerSecond = positions.value( game.gameId ) * 1000.0 / qMax<qint64>( total, 1 );
+        result << game;
+    }
+    return result;
+}
+
+
+int SolverBenchmark::compareWithBaseline( const QList<GameResult> & games ) const
+{
+    QFile file( m_baselineFile );
+    if ( !file.open( QIODevice::ReadOnly ) )
+    {
+        fprintf( stderr, "Can't read %s\n", qPrintable( m_baselineFile ) );
+        return 1;
+    }
+    const QJsonObject baseline = QJsonDocument::fromJson( file.readAll() ).object();
+
+    QHash<QPair<int,int>,int> verdicts;
+    foreach ( const QJsonValue & value, baseline.value( QStringLiteral( "cases" ) ).toArray() )
+    {
+        const QJsonObject c = value.toObject();
+        verdicts.insert( qMakePair( c.value( QStringLiteral( "game" ) ).toInt(),
+                                    c.value( QStringLiteral( "deal" ) ).toInt() ),
+                         c.value( QStringLiteral( "status" ) ).toInt() );
+    }
+
+    int failures = 0;
+    foreach ( const Case & c, m_cases )
+    {
+        const QPair<int,int> key = qMakePair( c.gameId, c.dealNumber );
+        if ( verdicts.contains( key ) && verdicts.value( key ) != c.status )
+        {
+            fprintf( stdout, "FLIP game %d deal %d: %d before, %d now\n",
+                     c.gameId, c.dealNumber, verdicts.value( key ), c.status );
+            ++failures;
+        }
+    }
+
+    QHash<int,QJsonObject> before;
+    foreach ( const QJsonValue & value, baseline.value( QStringLiteral( "games" ) ).toArray() )
+    {
+        const QJsonObject game = value.toObject();
+        before.insert( game.value( QStringLiteral( "game" ) ).toInt(), game );
+    }
+
+    foreach ( const GameResult & game, games )
+    {
+        if ( !before.contains( game.gameId ) )
+            continue;
+
+        const QJsonObject old = before.value( game.gameId );
+        const qint64 p50 = qint64( old.value( QStringLiteral( "p50" ) ).toDouble() );
+        const qint64 p95 = qint64( old.value( QStringLiteral( "p95" ) ).toDouble() );
+        if ( ( game.p50 > p50 * ( 100 + m_threshold ) / 100 && game.p50 > p50 + LATENCY_SLACK )
+             || ( game.p95 > p95 * ( 100 + m_threshold ) / 100 && game.p95 > p95 + LATENCY_SLACK ) )
+        {
+            fprintf( stdout, "SLOWER game %d: p50 %lld ms, p95 %lld ms, was %lld ms and %lld ms\n",
+                     game.gameId, game.p50, game.p95, p50, p95 );
+            ++failures;
+        }
+    }
+    return failures;
+}
+
+
+void SolverBenchmark::writeResults( const QList<GameResult> & games ) const
+{
+    QJsonArray cases;
+    foreach ( const Case & c, m_cases )
+    {
+        QJsonObject object;
+        object.insert( QStringLiteral( "game" ), c.gameId );
+        object.insert( QStringLiteral( "deal" ), c.dealNumber );
+        object.insert( QStringLiteral( "expected" ), c.expected );
+        object.insert( QStringLiteral( "status" ), c.status );
+        object.insert( QStringLiteral( "msecs" ), double( c.msecs ) );
+        object.insert( QStringLiteral( "positions" ), double( c.positions ) );
+        cases.append( object );
+    }
+
+    QJsonArray gameArray;
+    foreach ( const GameResult & game, games )
+    {
+        QJsonObject object;
+        object.insert( QStringLiteral( "game" ), game.gameId );
+        object.insert( QStringLiteral( "cases" ), game.cases );
+        object.insert( QStringLiteral( "wrong" ), game.wrong );
+        object.insert( QStringLiteral( "p50" ), double( game.p50 ) );
+        object.insert( QStringLiteral( "p95" ), double( game.p95 ) );
+        object.insert( QStringLiteral( "max" ), double( game.max ) );
+        object.insert( QStringLiteral( "positionsPerSecond" ), game.positionsPerSecond );
+        gameArray.append( object );
+    }
+
+    QJsonObject root;
+    root.insert( QStringLiteral( "directory" ), m_directory );
+    root.insert( QStringLiteral( "jobs" ), m_jobs );
+    root.insert( QStringLiteral( "cases" ), cases );
+    root.insert( QStringLiteral( "games" ), gameArray );
+
+    QFile file( m_resultsFile );
+    if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+    {
+        fprintf( stderr, "Can't write %s\n", qPrintable( m_resultsFile ) );
+        return;
+    }
+    file.write( QJsonDocument( root ).toJson() );
+}
+
+
+int SolverBenchmark::run()
+{
+    if ( !readCases() )
+        return -1;
+
+    QList<SolverBenchmarkThread*> threads;
+    for ( int i = 0; i < m_jobs; ++i )
+        threads << new SolverBenchmarkThread( this );
+    m_cursor.store( 0 );
+    foreach ( SolverBenchmarkThread * thread, threads )
+        thread->start();
+    foreach ( SolverBenchmarkThread * thread, threads )
+        thread->wait();
+    qDeleteAll( threads );
+
+    int failures = 0;
+    foreach ( const Case & c, m_cases )
+    {
+        if ( c.status != c.expected )
+        {
+            fprintf( stdout, "WRONG game %d deal %d: expected %d, got %d (%lld ms)\n",
+                     c.gameId, c.dealNumber, c.expected, c.status, c.msecs );
+            ++failures;
+        }
+    }
+
+    const QList<GameResult> games = gameResults();
+    foreach ( const GameResult & game, games )
+        fprintf( stdout, "game %d: %d cases, %d wrong, p50 %lld ms, p95 %lld ms, max %lld ms, %.0f positions/s\n",
+                 game.gameId, game.cases, game.wrong, game.p50, game.p95, game.max, game.positionsPerSecond );
+
+    if ( !m_baselineFile.isEmpty() )
+        failures += compareWithBaseline( games );
+    if ( !m_resultsFile.isEmpty() )
+        writeResults( games );
+
+    fprintf( stdout, "%d cases, %d failures\n", m_cases.size(), failures );
+    return failures;
+}
@@ -0,0 +1,96 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+class SolverBenchmarkThread;
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QList>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+
+/* Solves the test cases that kpat --generate writes to a directory and
+   checks the verdicts.  A case is a file named <game id>-<deal number>-<1
+   if won, 0 if lost>; the solver of the game deals it again from its
+   number, so the saved layout itself isn't read.  Prints the latency
+   percentiles and the search speed of every game, and fails if a verdict
+   differs from the file name or from the results of an earlier run, or if
+   a game got slower than that run by more than a threshold. */
+class SolverBenchmark
+{
+public:
+    explicit SolverBenchmark( const QString & directory );
+    ~SolverBenchmark();
+
+    /* Solve this many cases in parallel (default 1). */
+    void setJobs( int jobs ) { m_jobs = qMax( 1, jobs ); }
+
+    /* Write the results to this file as JSON, to be the baseline of a
+       later run. */
+    void setResultsFile( const QString & fileName ) { m_resultsFile = fileName; }
+
+    /* Compare with the results file of an earlier run.  A game regresses
+       if its p50 or p95 latency grew by more than percent, and by more
+       than a few milliseconds, so that quick games don't fail on timer
+       noise. */
+    void setBaseline( const QString & fileName, int percent );
+
+    /* Returns the number of failures, or -1 if there is nothing to run. */
+    int run();
+
+private:
+    struct Case
+    {
+        int gameId;
+        int dealNumber;
+        int expected;               /* the verdict of the file name */
+        int status;                 /* a Solver::ExitStatus */
+        qint64 msecs;
+        unsigned long positions;
+    };
+
+    struct GameResult
+    {
+        int gameId;
+        int cases;
+        int wrong;
+        qint64 p50;
+        qint64 p95;
+        qint64 max;
+        double positionsPerSecond;
+    };
+
+    bool readCases();
+    bool nextCase( int * index );
+    QList<GameResult> gameResults() const;
+    int compareWithBaseline( const QList<GameResult> & games ) const;
+    void writeResults( const QList<GameResult> & games ) const;
+
+    QString m_directory;
+    int m_jobs;
+    QString m_resultsFile;
+    QString m_baselineFile;
+    int m_threshold;
+
+    QVector<Case> m_cases;
+    QAtomicInt m_cursor;
+
+    friend class SolverBenchmarkThread;
+};
+
+#endif // BENCHMARK_H
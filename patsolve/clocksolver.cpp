@@ -17,7 +17,9 @@
 
 #include "clocksolver.h"
 
+#ifndef PATSOLVE_HEADLESS
 #include "../clock.h"
+#endif
 
 #include <QDebug>
 
@@ -229,6 +231,11 @@ int ClockSolver::getOuts()
     return ret;
 }
 
+unsigned int ClockSolver::getClusterNumber()
+{
+    return getOuts();
+}
+
 ClockSolver::ClockSolver(const Clock *dealer)
     : Solver()
 {
@@ -236,6 +243,39 @@ ClockSolver::ClockSolver(const Clock *dealer)
     deal = dealer;
 }
 
+/* Deal like Clock::restart(): the twelve clock cards go straight to
+their targets, everything else is dealt round the stores. */
+
+void ClockSolver::deal_layout( int dealNumber )
+{
+    static const card_t targets[12] = { PS_DIAMOND + 9, PS_SPADE + 10, PS_HEART + 11, PS_CLUB + 12,
+                                        PS_DIAMOND + 13, PS_SPADE + 2, PS_HEART + 3, PS_CLUB + 4,
+                                        PS_DIAMOND + 5, PS_SPADE + 6, PS_HEART + 7, PS_CLUB + 8 };
+    DealDeck cards( dealNumber );
+
+    clear_layout();
+    for ( int i = 0; i < 12; ++i )
+        W[8][i] = targets[i];
+    Wp[8] = &W[8][11];
+    Wlen[8] = 12;
+
+    int j = 0;
+    while ( !cards.isEmpty() )
+    {
+        card_t c = cards.takeLast();
+        bool isTarget = false;
+        for ( int i = 0; i < 12; ++i )
+            if ( c == targets[i] )
+                isTarget = true;
+        if ( !isTarget )
+        {
+            deal_card( j, c );
+            j = ( j + 1 ) % 8;
+        }
+    }
+}
+
+#ifndef PATSOLVE_HEADLESS
 /* Read a layout file.  Format is one pile per line, bottom to top (visible
 card).  Temp cells and Out on the last two lines, if any. */
 
@@ -270,8 +310,13 @@ void ClockSolver::translate_layout()
 
 MoveHint ClockSolver::translateMove( const MOVE &m )
 {
+    if ( m.from >= 8 || m.to >= ( m.totype == O_Type ? 12 : 8 ) )
+        return MoveHint();
+
     PatPile *frompile = deal->store[m.from];
     KCard *card = frompile->topCard();
+    if ( !card )
+        return MoveHint();
 
     if ( m.totype == O_Type )
     {
@@ -280,6 +325,7 @@ MoveHint ClockSolver::translateMove( const MOVE &m )
         return MoveHint( card, deal->store[m.to], m.pri );
     }
 }
+#endif
 
 void ClockSolver::print_layout()
 {
@@ -17,7 +17,9 @@
 
 #include "fortyeightsolver.h"
 
+#ifndef PATSOLVE_HEADLESS
 #include "../fortyeight.h"
+#endif
 
 #include <QDebug>
 
@@ -549,9 +551,41 @@ FortyeightSolver::FortyeightSolver(const Fortyeight *dealer)
     : Solver()
 {
     setNumberPiles( 10 );
+    addSymmetricPiles( 0, 8 );
     deal = dealer;
 }
 
+/* Deal like Fortyeight::restart(). */
+
+void FortyeightSolver::deal_layout( int dealNumber )
+{
+    DealDeck cards( dealNumber, 2 );
+
+    clear_layout();
+    for ( int r = 0; r < 4; ++r )
+        for ( int column = 0; column < 8; ++column )
+            deal_card( column, cards.takeLast() );
+
+    // The top card of the talon is flipped to the pile.
+    deal_card( NUM_PILE, cards.takeLast() );
+    while ( !cards.isEmpty() )
+        deal_card( NUM_DECK, cards.takeFirst(), false );
+
+    for ( int i = 0; i < 8; ++i )
+        O[i] = NONE;
+    Osuit[0] = PS_DIAMOND;
+    Osuit[1] = PS_DIAMOND;
+    Osuit[2] = PS_CLUB;
+    Osuit[3] = PS_CLUB;
+    Osuit[4] = PS_HEART;
+    Osuit[5] = PS_HEART;
+    Osuit[6] = PS_SPADE;
+    Osuit[7] = PS_SPADE;
+
+    lastdeal = false;
+}
+
+#ifndef PATSOLVE_HEADLESS
 void FortyeightSolver::translate_layout()
 {
     /* Read the workspace. */
@@ -608,6 +642,7 @@ void FortyeightSolver::translate_layout()
 
     Q_ASSERT( total == 104 );
 }
+#endif
 
 unsigned int FortyeightSolver::getClusterNumber()
 {
@@ -622,20 +657,22 @@ unsigned int FortyeightSolver::getClusterNumber()
     return k;
 }
 
+#ifndef PATSOLVE_HEADLESS
 MoveHint FortyeightSolver::translateMove( const MOVE &m )
 {
     if ( m.from == NUM_DECK || m.to == NUM_DECK )
         return MoveHint();
+    if ( m.from > NUM_DECK || ( m.totype == W_Type && m.to >= NUM_PILE ) )
+        return MoveHint();
     PatPile *frompile = 0;
     if ( m.from < 8 )
         frompile = deal->stack[m.from];
     else
         frompile = deal->pile;
 
-    Q_ASSERT( frompile );
-    KCard *card = frompile->at( frompile->count() - m.card_index - 1);
-    Q_ASSERT( card );
-    Q_ASSERT( m.to < NUM_PILE );
+    KCard *card = moved_card( frompile, m );
+    if ( !card )
+        return MoveHint();
     if ( m.totype == W_Type)
       return MoveHint( card, deal->stack[m.to], m.pri );
 
@@ -649,9 +686,9 @@ MoveHint FortyeightSolver::translateMove( const MOVE &m )
 	  return MoveHint( card, deal->target[i], m.pri );
       }
     }
-    Q_ASSERT( false);
     return MoveHint();
 }
+#endif
 
 void FortyeightSolver::print_layout()
 {
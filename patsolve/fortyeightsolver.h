@@ -34,12 +34,16 @@ public:
     virtual void undo_move(MOVE *m);
     virtual int getOuts();
     virtual unsigned int getClusterNumber();
-    virtual void translate_layout();
     virtual void unpack_cluster( unsigned int k );
-    virtual MoveHint translateMove(const MOVE &m);
     bool checkMove( int from, int to, MOVE *mp );
     bool checkMoveOut( int from, MOVE *mp, int *dropped );
     void checkState(FortyeightSolverState &d);
+    virtual void deal_layout( int dealNumber );
+    virtual Solver *clone() const { return new FortyeightSolver( *this ); }
+#ifndef PATSOLVE_HEADLESS
+    virtual void translate_layout();
+    virtual MoveHint translateMove(const MOVE &m);
+#endif
 
     virtual void print_layout();
 
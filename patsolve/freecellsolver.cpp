@@ -18,7 +18,9 @@
 
 #include "freecellsolver.h"
 
+#ifndef PATSOLVE_HEADLESS
 #include "../freecell.h"
+#endif
 
 
 /* Some macros used in get_possible_moves(). */
@@ -30,7 +32,7 @@
 
 /* Statistics. */
 
-int FreecellSolver::Xparam[] = { 4, 1, 8, -1, 7, 11, 4, 2, 2, 1, 2 };
+static const int DEFAULT_XPARAM[FreecellSolver::NXPARAM] = { 4, 1, 8, -1, 7, 11, 4, 2 };
 
 /* These two routines make and unmake moves. */
 
@@ -399,10 +401,51 @@ FreecellSolver::FreecellSolver(const Freecell *dealer)
     Ntpiles = 4;
 
     setNumberPiles( Nwpiles + Ntpiles );
+    addSymmetricPiles( 0, Nwpiles );
+    addSymmetricPiles( Nwpiles, Ntpiles );
 
     deal = dealer;
+    for ( int i = 0; i < NXPARAM; ++i )
+        Xparam[i] = DEFAULT_XPARAM[i];
+}
+
+QVector<qreal> FreecellSolver::parameters() const
+{
+    QVector<qreal> values = Solver::parameters();
+    for ( int i = 0; i < NXPARAM; ++i )
+        values << Xparam[i];
+    return values;
+}
+
+bool FreecellSolver::setParameters( const QVector<qreal> & values )
+{
+    if ( !Solver::setParameters( values ) )
+        return false;
+    const qreal *x = values.constData() + values.size() - NXPARAM;
+    for ( int i = 0; i < NXPARAM; ++i )
+        Xparam[i] = qBound( -127, qRound( x[i] ), 127 );
+    return true;
+}
+
+/* Deal like Freecell::restart(). */
+
+void FreecellSolver::deal_layout( int dealNumber )
+{
+    DealDeck cards( dealNumber );
+
+    clear_layout();
+    int column = 0;
+    while ( !cards.isEmpty() )
+    {
+        deal_card( column, cards.takeLast() );
+        column = ( column + 1 ) % Nwpiles;
+    }
+
+    for ( int i = 0; i < 4; ++i )
+        O[i] = NONE;
 }
 
+#ifndef PATSOLVE_HEADLESS
 /* Read a layout file.  Format is one pile per line, bottom to top (visible
 card).  Temp cells and Out on the last two lines, if any. */
 
@@ -450,12 +493,17 @@ MoveHint FreecellSolver::translateMove( const MOVE &m )
 {
     // this is tricky as we need to want to build the "meta moves"
 
+    if ( m.from >= 12 || ( m.totype == W_Type && m.to >= 12 ) )
+        return MoveHint();
+
     PatPile *frompile = 0;
     if ( m.from < 8 )
         frompile = deal->store[m.from];
     else
         frompile = deal->freecell[m.from-8];
-    KCard *card = frompile->at( frompile->count() - m.card_index - 1);
+    KCard *card = moved_card( frompile, m );
+    if ( !card )
+        return MoveHint();
 
     if ( m.totype == O_Type )
     {
@@ -485,6 +533,7 @@ MoveHint FreecellSolver::translateMove( const MOVE &m )
         return MoveHint( card, target, m.pri );
     }
 }
+#endif
 
 unsigned int FreecellSolver::getClusterNumber()
 {
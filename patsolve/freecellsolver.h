@@ -35,9 +35,15 @@ public:
     virtual void prioritize(MOVE *mp0, int n);
     virtual int getOuts();
     virtual unsigned int getClusterNumber();
-    virtual void translate_layout();
     virtual void unpack_cluster( unsigned int k );
+    virtual void deal_layout( int dealNumber );
+    virtual QVector<qreal> parameters() const;
+    virtual bool setParameters( const QVector<qreal> & values );
+    virtual Solver *clone() const { return new FreecellSolver( *this ); }
+#ifndef PATSOLVE_HEADLESS
+    virtual void translate_layout();
     virtual MoveHint translateMove(const MOVE &m);
+#endif
 
     virtual void print_layout();
 
@@ -51,7 +57,8 @@ public:
 
     const Freecell *deal;
 
-    static int Xparam[];
+    enum { NXPARAM = 8 };
+    int Xparam[NXPARAM];     /* the weights of prioritize() */
 
 };
 
@@ -17,10 +17,14 @@
 
 #include "golfsolver.h"
 
+#ifndef PATSOLVE_HEADLESS
 #include "../golf.h"
+#endif
 
 #include <QDebug>
 
+#include <cstring>
+
 
 #define PRINT 0
 
@@ -156,8 +160,8 @@ int GolfSolver::get_possible_moves(int *a, int *numout)
         }
     }
 
-    /* check for deck->pile */
-    if ( !n && Wlen[8] ) {
+    /* check for deck->pile, the player may deal at any time */
+    if ( Wlen[8] ) {
         mp->card_index = 1;
         mp->from = 8;
         mp->to = 7;
@@ -182,13 +186,345 @@ int GolfSolver::getOuts()
     return Wlen[7];
 }
 
+/* Cards only ever leave the stock.  The height of the waste would tell the
+positions apart as well, but as every move grows it, every move would start
+a new cluster and solve() would search depth first alone. */
+
+unsigned int GolfSolver::getClusterNumber()
+{
+    return Wlen[8];
+}
+
+/* A card in the columns needs one a rank higher or lower on the waste.
+That one may come from the stock, be on the waste already or be played from
+the columns, but not from under a card that can never be played itself.
+Starting with all of the columns stuck, free the top cards that have such a
+card until nothing changes.  What is left is stuck for good.  The columns
+have heights[w] cards, avail has a bit for every rank in the stock or on
+the waste. */
+
+static bool columnsStuck( card_t * const *W, const int *heights, unsigned int avail )
+{
+    int first[7];
+    for ( int w = 0; w < 7; ++w )
+        first[w] = heights[w] - 1;
+
+    bool freed;
+    do
+    {
+        freed = false;
+        for ( int w = 0; w < 7; ++w )
+        {
+            while ( first[w] >= 0 )
+            {
+                int r = RANK( W[w][first[w]] );
+                if ( !( avail & ( 5u << ( r - 1 ) ) ) )
+                    break;
+                avail |= 1u << r;
+                first[w]--;
+                freed = true;
+            }
+        }
+    } while ( freed );
+
+    for ( int w = 0; w < 7; ++w )
+        if ( first[w] >= 0 )
+            return true;
+    return false;
+}
+
+bool GolfSolver::isDeadEnd( const MOVE * )
+{
+    unsigned int avail = 0;
+    for ( int i = 0; i < Wlen[8]; ++i )
+        avail |= 1u << RANK( W[8][i] );
+    if ( Wlen[7] )
+        avail |= 1u << RANK( *Wp[7] );
+    return columnsStuck( W, Wlen, avail );
+}
+
+/* Golf needs none of the machinery of the general search: a layout is
+the heights of the seven columns, the height of the stock and the rank on
+the waste, and every move puts a card on the waste, so no layout comes back
+on the same line.  own_search() goes depth first through the layouts and
+only remembers the ones that are lost, by a key of four bits for every
+column, six for the stock and four for the rank. */
+
+#define KEYBITS 38
+
+quint64 GolfSolver::layout_key() const
+{
+    quint64 key = m_top | ( m_stock << 4 );
+    for ( int w = 0; w < 7; ++w )
+        key |= quint64( m_height[w] ) << ( 10 + 4 * w );
+    return key;
+}
+
+static inline int lost_slot( quint64 key, int mask )
+{
+    return int( ( key * Q_UINT64_C( 0x9E3779B97F4A7C15 ) ) >> 32 ) & mask;
+}
+
+bool GolfSolver::find_lost( quint64 key ) const
+{
+    const quint64 entry = key | ( m_generation << KEYBITS );
+    const int mask = m_lostSize - 1;
+    const quint64 *slots = m_lost;
+    for ( int i = lost_slot( key, mask ); ; i = ( i + 1 ) & mask )
+    {
+        if ( slots[i] == entry )
+            return true;
+        if ( ( slots[i] >> KEYBITS ) != m_generation )
+            return false;
+    }
+}
+
+/* The table doubles when it is half full, unless mm has no room for the
+bigger one.  Then it takes no more than three quarters and the search simply
+visits the layouts it can't remember again. */
+
+void GolfSolver::insert_lost( quint64 key )
+{
+    if ( 2 * ( m_lostCount + 1 ) > m_lostSize )
+    {
+        quint64 *bigger = new_array( quint64, m_lostSize * 2 );
+        if ( bigger )
+        {
+            quint64 *old = m_lost;
+            const int oldSize = m_lostSize;
+            m_lost = bigger;
+            m_lostSize *= 2;
+            m_lostCount = 0;
+            for ( int i = 0; i < oldSize; ++i )
+                if ( ( old[i] >> KEYBITS ) == m_generation )
+                    insert_lost( old[i] & ( ( Q_UINT64_C( 1 ) << KEYBITS ) - 1 ) );
+            mm->free_array( old, oldSize );
+        }
+        else if ( 4 * ( m_lostCount + 1 ) > 3 * m_lostSize )
+        {
+            return;
+        }
+    }
+
+    const int mask = m_lostSize - 1;
+    quint64 *slots = m_lost;
+    int i = lost_slot( key, mask );
+    while ( ( slots[i] >> KEYBITS ) == m_generation )
+        i = ( i + 1 ) & mask;
+    slots[i] = key | ( m_generation << KEYBITS );
+    m_lostCount++;
+}
+
+/* The line to the layout at depth is in m_line, all that is left to win is
+to deal the stock. */
+
+void GolfSolver::win_line( int depth )
+{
+    for ( int i = 0; i < depth; ++i )
+        winMoves.append( m_line[i] );
+
+    MOVE m;
+    m.card_index = 1;
+    m.from = 8;
+    m.to = 7;
+    m.totype = W_Type;
+    m.pri = 5;
+    m.turn_index = 0;
+    for ( int i = 0; i < m_stock; ++i )
+        winMoves.append( m );
+
+    Status = SolutionExists;
+}
+
+bool GolfSolver::search_columns( int depth )
+{
+    int left = 0;
+    for ( int w = 0; w < 7; ++w )
+        left += m_height[w];
+    if ( !left )
+    {
+        win_line( depth );
+        return true;
+    }
+
+    const quint64 key = layout_key();
+    if ( find_lost( key ) )
+        return false;
+    if ( columnsStuck( W, m_height, m_stockRanks[m_stock] | ( 1u << m_top ) ) )
+    {
+        Dead_ends++;
+        insert_lost( key );
+        return false;
+    }
+
+    Total_positions++;
+    if ( ( Total_positions & 1023 ) == 0 )
+    {
+        QMutexLocker lock( &endMutex );
+        if ( m_shouldEnd )
+        {
+            Status = SearchAborted;
+            return false;
+        }
+    }
+    if ( max_positions != -1 && Total_positions > ( unsigned long )max_positions )
+    {
+        Status = MemoryLimitReached;
+        return false;
+    }
+    Maxdepth = qMax( Maxdepth, depth );
+
+    const int top = m_top;
+    MOVE *m = &m_line[depth];
+    for ( int w = 0; w < 7; ++w )
+    {
+        if ( !m_height[w] )
+            continue;
+        const int rank = RANK( W[w][m_height[w] - 1] );
+        if ( rank != top - 1 && rank != top + 1 )
+            continue;
+
+        m->card_index = 0;
+        m->from = w;
+        m->to = 7;
+        m->totype = W_Type;
+        m->pri = ( rank == PS_ACE || rank == PS_KING ) ? 30 : 13;
+        m->turn_index = -1;
+
+        m_height[w]--;
+        m_top = rank;
+        const bool won = search_columns( depth + 1 );
+        m_height[w]++;
+        m_top = top;
+        if ( won )
+            return true;
+        if ( Status != NoSolutionExists )
+            return false;
+    }
+
+    /* Dealing is always allowed, it goes last like in get_possible_moves(). */
+    if ( m_stock )
+    {
+        m->card_index = 1;
+        m->from = 8;
+        m->to = 7;
+        m->totype = W_Type;
+        m->pri = 5;
+        m->turn_index = 0;
+
+        m_stock--;
+        m_top = RANK( W[8][m_stock] );
+        const bool won = search_columns( depth + 1 );
+        m_stock++;
+        m_top = top;
+        if ( won )
+            return true;
+        if ( Status != NoSolutionExists )
+            return false;
+    }
+
+    insert_lost( key );
+    return false;
+}
+
+bool GolfSolver::own_search()
+{
+    /* Layouts that don't fit the key or the line go to doit(). */
+    int cards = Wlen[8];
+    if ( !Wlen[7] || Wlen[8] >= 64 )
+        return false;
+    for ( int w = 0; w < 7; ++w )
+    {
+        if ( Wlen[w] >= 16 )
+            return false;
+        m_height[w] = Wlen[w];
+        cards += Wlen[w];
+    }
+    if ( cards > 52 )
+        return false;
+    m_stock = Wlen[8];
+    m_top = RANK( *Wp[7] );
+    if ( !m_lost )
+    {
+        m_lost = new_array( quint64, 1 << 12 );
+        if ( !m_lost )
+            return false;
+        m_lostSize = 1 << 12;
+    }
+    m_stockRanks[0] = 0;
+    for ( int i = 0; i < m_stock; ++i )
+        m_stockRanks[i + 1] = m_stockRanks[i] | ( 1u << RANK( W[8][i] ) );
+
+    /* A new generation empties the table. */
+    if ( ++m_generation >> ( 64 - KEYBITS ) )
+    {
+        memset( m_lost, 0, m_lostSize * sizeof( quint64 ) );
+        m_generation = 1;
+    }
+    m_lostCount = 0;
+
+    search_columns( 0 );
+
+    int nmoves;
+    MOVE *mp0 = get_moves( &nmoves );
+    if ( mp0 )
+    {
+        for ( int j = 0; j < nmoves; ++j )
+            firstMoves.append( Possible[j] );
+        mm->free_array( mp0, nmoves );
+    }
+    return true;
+}
+
 GolfSolver::GolfSolver(const Golf *dealer)
-    : Solver()
+    : Solver(),
+      m_lost( 0 ),
+      m_lostSize( 0 ),
+      m_generation( 0 ),
+      m_lostCount( 0 )
 {
     setNumberPiles( 9 );
     deal = dealer;
 }
 
+/* A clone starts with a table of its own. */
+
+GolfSolver::GolfSolver(const GolfSolver &other)
+    : Solver( other ),
+      m_lost( 0 ),
+      m_lostSize( 0 ),
+      m_generation( 0 ),
+      m_lostCount( 0 )
+{
+    deal = other.deal;
+}
+
+GolfSolver::~GolfSolver()
+{
+    if ( m_lost )
+        mm->free_array( m_lost, m_lostSize );
+}
+
+/* Deal like Golf::restart().  Golf doesn't care about suits, so they are
+all made spades, as translate_layout() does. */
+
+void GolfSolver::deal_layout( int dealNumber )
+{
+    static const card_t suits[4] = { PS_SPADE, PS_SPADE, PS_SPADE, PS_SPADE };
+    DealDeck cards( dealNumber, 1, suits );
+
+    clear_layout();
+    for ( int i = 0; i < 5; ++i )
+        for ( int r = 0; r < 7; ++r )
+            deal_card( r, cards.takeLast() );
+
+    // The top card of the talon is flipped to the waste.
+    deal_card( 7, cards.takeLast() );
+    while ( !cards.isEmpty() )
+        deal_card( 8, cards.takeFirst(), false );
+}
+
+#ifndef PATSOLVE_HEADLESS
 /* Read a layout file.  Format is one pile per line, bottom to top (visible
 card).  Temp cells and Out on the last two lines, if any. */
 
@@ -234,10 +570,13 @@ MoveHint GolfSolver::translateMove( const MOVE &m )
         return MoveHint();
     PatPile *frompile = deal->stack[m.from];
 
-    KCard *card = frompile->at( frompile->count() - m.card_index - 1);
+    KCard *card = moved_card( frompile, m );
+    if ( !card )
+        return MoveHint();
 
     return MoveHint( card, deal->waste, m.pri );
 }
+#endif
 
 void GolfSolver::print_layout()
 {
@@ -26,18 +26,53 @@ class GolfSolver : public Solver
 {
 public:
     GolfSolver(const Golf *dealer);
+    GolfSolver(const GolfSolver &other);
+    virtual ~GolfSolver();
     int good_automove(int o, int r);
     virtual int get_possible_moves(int *a, int *numout);
     virtual bool isWon();
     virtual void make_move(MOVE *m);
     virtual void undo_move(MOVE *m);
     virtual int getOuts();
+    virtual unsigned int getClusterNumber();
+    virtual bool isDeadEnd( const MOVE *m );
+    virtual void deal_layout( int dealNumber );
+    virtual Solver *clone() const { return new GolfSolver( *this ); }
+#ifndef PATSOLVE_HEADLESS
     virtual void translate_layout();
     virtual MoveHint translateMove(const MOVE &m);
+#endif
 
     virtual void print_layout();
 
     const Golf *deal;
+
+protected:
+    virtual bool own_search();
+
+private:
+    bool search_columns( int depth );
+    quint64 layout_key() const;
+    bool find_lost( quint64 key ) const;
+    void insert_lost( quint64 key );
+    void win_line( int depth );
+
+    /* The layout as own_search() plays it: the cards stay in W, only the
+       heights of the columns and of the stock and the rank on top of the
+       waste change. */
+    int m_height[7];
+    int m_stock;
+    int m_top;
+    unsigned int m_stockRanks[64];  /* a bit for every rank in the stock */
+    MOVE m_line[52];
+
+    /* The keys of the layouts known to be lost, open addressing.  A slot
+       is taken if it has the generation of the current search.  The
+       table comes from mm, so it counts against the memory limit. */
+    quint64 *m_lost;
+    int m_lostSize;             /* always a power of two */
+    quint64 m_generation;
+    int m_lostCount;
 };
 
 #endif // GOLFSOLVER_H
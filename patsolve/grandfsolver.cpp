@@ -17,7 +17,9 @@
 
 #include "grandfsolver.h"
 
+#ifndef PATSOLVE_HEADLESS
 #include "../grandf.h"
+#endif
 
 #include <QDebug>
 
@@ -199,7 +201,7 @@ void GrandfSolver::undo_move(MOVE *m)
         {
             int pile = m_redeal * 7 + i;
             Wlen[pile] = 0;
-            Wp[pile] = &W[pile][0];
+            Wp[pile] = &W[pile][-1];
             hashpile( pile );
         }
         m_redeal--;
@@ -219,8 +221,12 @@ void GrandfSolver::undo_move(MOVE *m)
     }
 
     if (m->totype == O_Type) {
-        card = W[offs][Osuit[to]];
-        W[offs][to]--;
+        card = W[offs][to];
+        if ( RANK( card ) == PS_ACE )
+            W[offs][to] = card + ( 1 << 7 );
+        else
+            W[offs][to]--;
+        hashpile( offs );
         Wp[from]++;
         *Wp[from] = card;
         Wlen[from]++;
@@ -402,6 +408,20 @@ int GrandfSolver::getOuts()
     return outs;
 }
 
+/* Only on the last deal, a redeal gathers the face down cards up again.
+Then only a card going out can freeze others, see KlondikeSolver. */
+
+bool GrandfSolver::isDeadEnd( const MOVE *m )
+{
+    if ( m_redeal < 2 || ( m && m->totype != O_Type && m->from != offs ) )
+        return false;
+
+    card_t out[4];
+    for ( int o = 0; o < 4; ++o )
+        out[o] = DOWN( W[offs][o] ) ? NONE : RANK( W[offs][o] );
+    return frozen_cards( m_redeal * 7, 7, out, true );
+}
+
 GrandfSolver::GrandfSolver(const Grandf *dealer)
     : Solver()
 {
@@ -416,6 +436,52 @@ GrandfSolver::GrandfSolver(const Grandf *dealer)
     m_redeal = -1;
 }
 
+/* Deal like Grandf::deal() for the first of the three deals. */
+
+void GrandfSolver::deal_layout( int dealNumber )
+{
+    DealDeck cards( dealNumber );
+
+    m_redeal = 0;
+    clear_layout();
+
+    int start = 0;
+    int stop = 7-1;
+    int dir = 1;
+
+    for ( int round = 0; round < 7; ++round )
+    {
+        int i = start;
+        do
+        {
+            if ( !cards.isEmpty() )
+                deal_card( i, cards.takeLast(), i == start );
+            i += dir;
+        } while ( i != stop + dir );
+        int t = start;
+        start = stop;
+        stop = t+dir;
+        dir = -dir;
+    }
+
+    int i = 0;
+    while ( !cards.isEmpty() )
+    {
+        deal_card( i+1, cards.takeLast() );
+        i = ( i+1 ) % 6;
+    }
+
+    for ( int w = 0; w < 7; ++w )
+        if ( Wlen[w] )
+            *Wp[w] = *Wp[w] & ~( 1 << 7 );
+
+    Wlen[offs] = 4;
+    for ( int i = 0; i < 4; ++i )
+        W[offs][i] = ( i << 4 ) + PS_ACE + ( 1 << 7 );
+    Wp[offs] = &W[offs][3];
+}
+
+#ifndef PATSOLVE_HEADLESS
 /* Read a layout file.  Format is one pile per line, bottom to top (visible
 card).  Temp cells and Out on the last two lines, if any. */
 
@@ -453,13 +519,15 @@ void GrandfSolver::translate_layout()
 
 MoveHint GrandfSolver::translateMove( const MOVE &m )
 {
-    if ( m.from == offs )
+    if ( m.from >= offs )
         return MoveHint();
 
     PatPile *frompile = 0;
     frompile = deal->store[m.from % 7];
 
-    KCard *card = frompile->at( frompile->count() - m.card_index - 1);
+    KCard *card = moved_card( frompile, m );
+    if ( !card )
+        return MoveHint();
 
     if ( m.totype == O_Type )
     {
@@ -484,6 +552,7 @@ MoveHint GrandfSolver::translateMove( const MOVE &m )
     }
     return MoveHint();
 }
+#endif
 
 void GrandfSolver::print_layout()
 {
@@ -17,7 +17,9 @@
 
 #include "gypsysolver.h"
 
+#ifndef PATSOLVE_HEADLESS
 #include "../gypsy.h"
+#endif
 
 #include <QDebug>
 #include <assert.h>
@@ -172,6 +174,7 @@ void GypsySolver::undo_move(MOVE *m)
         if ( RANK( card ) == PS_ACE )
         {
             Wlen[to] = 0;
+            Wp[to]--;
         } else {
             *Wp[to] = card - 1; // SUIT( card ) << 4 + RANK( card ) - 1;
         }
@@ -440,12 +443,37 @@ int GypsySolver::getOuts()
     return k;
 }
 
+/* The two foundations of a suit are interchangeable, so only the sum of
+their ranks counts, five bits per suit. */
+
+unsigned int GypsySolver::getClusterNumber()
+{
+    unsigned int k = 0;
+    for ( int o = 0; o < 8; ++o )
+        if ( Wlen[outs + o] )
+            k += RANK( *Wp[outs + o] ) << ( 5 * ( o / 2 ) );
+
+    return k;
+}
+
+/* Dealing from the deck puts one card on every tableau pile in turn. */
+
+bool GypsySolver::pilesInterchangeable()
+{
+    return Wlen[deck] == 0;
+}
+
 GypsySolver::GypsySolver(const Gypsy *dealer)
     : Solver()
 {
     setNumberPiles( 8 + 1 + 8 );
     deal = dealer;
 
+    // The tableau, and the two foundations of every suit.
+    addSymmetricPiles( 0, 8 );
+    for ( int o = 0; o < 4; ++o )
+        addSymmetricPiles( 8 + 1 + o * 2, 2 );
+
     char buffer[10];
     params[0] = 3;
     params[1] = 3;
@@ -462,6 +490,46 @@ GypsySolver::GypsySolver(const Gypsy *dealer)
     }
 }
 
+QVector<qreal> GypsySolver::parameters() const
+{
+    QVector<qreal> values = Solver::parameters();
+    for ( int i = 0; i < 6; ++i )
+        values << params[i];
+    return values;
+}
+
+bool GypsySolver::setParameters( const QVector<qreal> & values )
+{
+    if ( !Solver::setParameters( values ) )
+        return false;
+    const qreal *x = values.constData() + values.size() - 6;
+    for ( int i = 0; i < 6; ++i )
+        params[i] = qBound( -127, qRound( x[i] ), 127 );
+    return true;
+}
+
+/* Deal like Gypsy::restart(). */
+
+void GypsySolver::deal_layout( int dealNumber )
+{
+    DealDeck cards( dealNumber, 2 );
+
+    deck = 8;
+    outs = 9;
+
+    clear_layout();
+    for ( int round = 0; round < 8; ++round )
+        deal_card( round, cards.takeLast(), false );
+    for ( int round = 0; round < 8; ++round )
+        deal_card( round, cards.takeLast() );
+    for ( int round = 0; round < 8; ++round )
+        deal_card( round, cards.takeLast() );
+
+    while ( !cards.isEmpty() )
+        deal_card( deck, cards.takeFirst(), false );
+}
+
+#ifndef PATSOLVE_HEADLESS
 /* Read a layout file.  Format is one pile per line, bottom to top (visible
    card).  Temp cells and Out on the last two lines, if any. */
 
@@ -501,6 +569,7 @@ void GypsySolver::translate_layout()
         }
     }
 }
+#endif
 
 void GypsySolver::print_layout()
 {
@@ -527,14 +596,17 @@ void GypsySolver::print_layout()
     return;
 }
 
+#ifndef PATSOLVE_HEADLESS
 MoveHint GypsySolver::translateMove( const MOVE &m )
 {
     //print_layout();
-    if ( m.from == deck )
+    if ( m.from >= deck || ( m.totype == W_Type && m.to >= deck ) )
         return MoveHint();
 
     PatPile *frompile = deal->store[m.from];
-    KCard *card = frompile->at( frompile->count() - m.card_index - 1);
+    KCard *card = moved_card( frompile, m );
+    if ( !card )
+        return MoveHint();
 
     if ( m.totype == O_Type )
     {
@@ -558,3 +630,4 @@ MoveHint GypsySolver::translateMove( const MOVE &m )
 
     return MoveHint( card, deal->store[m.to], m.pri );
 }
+#endif
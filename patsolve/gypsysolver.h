@@ -32,8 +32,16 @@ public:
     virtual void make_move(MOVE *m);
     virtual void undo_move(MOVE *m);
     virtual int getOuts();
+    virtual unsigned int getClusterNumber();
+    virtual bool pilesInterchangeable();
+    virtual void deal_layout( int dealNumber );
+    virtual QVector<qreal> parameters() const;
+    virtual bool setParameters( const QVector<qreal> & values );
+    virtual Solver *clone() const { return new GypsySolver( *this ); }
+#ifndef PATSOLVE_HEADLESS
     virtual void translate_layout();
     virtual MoveHint translateMove(const MOVE &m);
+#endif
 
     virtual void print_layout();
 
@@ -42,7 +50,7 @@ public:
     const Gypsy *deal;
 
     int deck, outs;
-    int params[6];
+    int params[6];          /* the weights of prioritize(), see parameters() */
 };
 
 #endif // GYPSYSOLVER_H
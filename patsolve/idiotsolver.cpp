@@ -17,7 +17,9 @@
 
 #include "idiotsolver.h"
 
+#ifndef PATSOLVE_HEADLESS
 #include "../idiot.h"
+#endif
 
 #include <QDebug>
 
@@ -198,6 +200,11 @@ int IdiotSolver::getOuts()
     return Wlen[5];
 }
 
+unsigned int IdiotSolver::getClusterNumber()
+{
+    return Wlen[5];
+}
+
 IdiotSolver::IdiotSolver(const Idiot *dealer)
     : Solver()
 {
@@ -205,6 +212,22 @@ IdiotSolver::IdiotSolver(const Idiot *dealer)
     deal = dealer;
 }
 
+/* Deal like Idiot::restart(): everything goes to the talon, then
+dealRow() flips its top four cards out. */
+
+void IdiotSolver::deal_layout( int dealNumber )
+{
+    DealDeck cards( dealNumber );
+
+    clear_layout();
+    for ( int i = 0; i < 4; ++i )
+        deal_card( i, cards.takeLast() );
+
+    while ( !cards.isEmpty() )
+        deal_card( 4, cards.takeFirst(), false );
+}
+
+#ifndef PATSOLVE_HEADLESS
 /* Read a layout file.  Format is one pile per line, bottom to top (visible
 card).  Temp cells and Out on the last two lines, if any. */
 
@@ -235,12 +258,13 @@ void IdiotSolver::translate_layout()
 
 MoveHint IdiotSolver::translateMove( const MOVE &m )
 {
-    if ( m.from >=4 )
+    if ( m.from >=4 || ( m.to >= 4 && m.to != 5 ) )
         return MoveHint();
     PatPile *frompile = deal->m_play[m.from];
 
-    KCard *card = frompile->at( frompile->count() - m.card_index - 1);
-    Q_ASSERT( card );
+    KCard *card = moved_card( frompile, m );
+    if ( !card )
+        return MoveHint();
 
     PatPile *target = 0;
     if ( m.to == 5 )
@@ -250,6 +274,7 @@ MoveHint IdiotSolver::translateMove( const MOVE &m )
 
     return MoveHint( card, target, m.pri );
 }
+#endif
 
 void IdiotSolver::print_layout()
 {
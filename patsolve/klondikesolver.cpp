@@ -17,7 +17,9 @@
 
 #include "klondikesolver.h"
 
+#ifndef PATSOLVE_HEADLESS
 #include "../klondike.h"
+#endif
 
 #include <QDebug>
 
@@ -61,7 +63,7 @@ void KlondikeSolver::make_move(MOVE *m)
                 W[8][Wlen[8]-1] = card;
                 Wlen[7]--;
             }
-            Wp[7] = &W[7][0];
+            Wp[7] = &W[7][Wlen[7]-1];
             Wp[8] = &W[8][Wlen[8]-1];
             hashpile( 7 );
             hashpile( 8 );
@@ -71,8 +73,8 @@ void KlondikeSolver::make_move(MOVE *m)
             return;
         }
 
-        // move to pile
-        if ( from == 8 && to == 7 )
+        // move to pile, and maybe play the card that comes up
+        if ( from == 8 )
         {
             for ( int i = 0; i < m->card_index; ++i )
             {
@@ -87,6 +89,21 @@ void KlondikeSolver::make_move(MOVE *m)
                 *Wp[7] = card;
                 Wlen[7]++;
             }
+            if ( isStockPlay( m ) )
+            {
+                card = *Wp[7];
+                Wp[7]--;
+                Wlen[7]--;
+                if ( m->totype == O_Type )
+                    O[to]++;
+                else
+                {
+                    Wp[to]++;
+                    *Wp[to] = card;
+                    Wlen[to]++;
+                    hashpile( to );
+                }
+            }
             hashpile( 7 );
             hashpile( 8 );
 #if PRINT
@@ -165,7 +182,7 @@ void KlondikeSolver::undo_move(MOVE *m)
                 W[7][Wlen[7]-1] = card;
                 Wlen[8]--;
             }
-            Wp[8] = &W[8][0];
+            Wp[8] = &W[8][Wlen[8]-1];
             Wp[7] = &W[7][Wlen[7]-1];
             hashpile( 7 );
             hashpile( 8 );
@@ -176,8 +193,26 @@ void KlondikeSolver::undo_move(MOVE *m)
         }
 
         // move back to deck
-        if ( from == 8 && to == 7 )
+        if ( from == 8 )
         {
+            if ( isStockPlay( m ) )
+            {
+                if ( m->totype == O_Type )
+                {
+                    card = O[to] + Osuit[to];
+                    O[to]--;
+                }
+                else
+                {
+                    card = *Wp[to];
+                    Wp[to]--;
+                    Wlen[to]--;
+                    hashpile( to );
+                }
+                Wp[7]++;
+                *Wp[7] = card;
+                Wlen[7]++;
+            }
             for ( int i = 0; i < m->card_index; ++i )
             {
                 card = *Wp[7];
@@ -334,9 +369,10 @@ int KlondikeSolver::get_possible_moves(int *a, int *numout)
     *a = false;
     *numout = n;
 
-    /* check for deck->pile */
+    /* check for deck->pile, all the way through when drawing more than
+       one, see stock_moves() */
     if ( Wlen[8] ) {
-        mp->card_index = qMin( m_draw, Wlen[8] );
+        mp->card_index = m_draw == 1 ? 1 : Wlen[8];
         mp->from = 8;
         mp->to = 7;
         mp->totype = W_Type;
@@ -431,6 +467,11 @@ int KlondikeSolver::get_possible_moves(int *a, int *numout)
         }
     }
 
+    if ( m_draw > 1 ) {
+        n += stock_moves( mp, MAXMOVES - 1 - n, first_empty_pile );
+        mp = Possible + n;
+    }
+
     if ( Wlen[8] == 0 && Wlen[7] > 1 )
     {
         mp->card_index = 0;
@@ -445,6 +486,113 @@ int KlondikeSolver::get_possible_moves(int *a, int *numout)
     return n;
 }
 
+/* Drawing only matters for the card it brings up, and the moves in
+between don't touch the stock, so every draw can as well be made right
+before that card is played.  Instead of drawing one turn at a time, a move
+from the deck draws as many cards as it takes to bring a card up and plays
+it, see isStockPlay().  These are the moves for the cards the deck brings
+up before it runs out, at most max of them.  The more turns the plays to
+the tableau draw, the later they come in the queues.  The plays to the
+foundations start a new cluster, so solve() searches them right away and
+their priority is unused, as for the other moves out.  The deck->pile move
+that draws all of it is left to get to a redeal.
+
+Drawing one, every card comes up in every pass anyway, and the search does
+better with a draw per move. */
+
+int KlondikeSolver::stock_moves( MOVE *mp, int max, int first_empty_pile )
+{
+    int n = 0;
+    int turns = 0;
+    for ( int drawn = qMin( m_draw, Wlen[8] ); drawn > 0 && n < max; )
+    {
+        ++turns;
+        card_t card = W[8][Wlen[8]-drawn];
+        card = ( SUIT( card ) << 4 ) + RANK( card );
+
+        int o = SUIT( card );
+        bool empty = ( O[o] == NONE );
+        if ( ( empty && RANK( card ) == PS_ACE ) ||
+             ( !empty && RANK( card ) == O[o] + 1 ) )
+        {
+            mp->card_index = drawn;
+            mp->from = 8;
+            mp->to = o;
+            mp->totype = O_Type;
+            mp->pri = 3;    /* unused */
+            mp->turn_index = 0;
+            n++;
+            mp++;
+        }
+
+        for ( int j = 0; j < 7 && n < max; ++j )
+        {
+            if ( ( Wlen[j] > 0 &&
+                   RANK( card ) == RANK( *Wp[j] ) - 1 &&
+                   suitable( card, *Wp[j] ) ) ||
+                 ( RANK( card ) == PS_KING && j == first_empty_pile ) )
+            {
+                mp->card_index = drawn;
+                mp->from = 8;
+                mp->to = j;
+                mp->totype = W_Type;
+                mp->pri = qMax( 0, 40 - 4 * turns );
+                mp->turn_index = 0;
+                n++;
+                mp++;
+            }
+        }
+
+        if ( drawn == Wlen[8] )
+            break;
+        drawn = qMin( drawn + m_draw, Wlen[8] );
+    }
+    return n;
+}
+
+/* A deck->pile move draws card_index cards, and plays the last of them
+unless it goes to the pile. */
+
+bool KlondikeSolver::isStockPlay( const MOVE *m )
+{
+    return m->from == 8 && ( m->to != 7 || m->totype == O_Type );
+}
+
+/* Every move from the deck becomes a draw per turn, as Klondike::newCards()
+does them, and the move of the card from the pile. */
+
+void KlondikeSolver::expand_moves( QList<MOVE> & moves )
+{
+    QList<MOVE> steps;
+    foreach ( const MOVE & m, moves )
+    {
+        if ( m.from != 8 )
+        {
+            steps.append( m );
+            continue;
+        }
+
+        MOVE draw = m;
+        draw.to = 7;
+        draw.totype = W_Type;
+        for ( int left = m.card_index; left > 0; left -= m_draw )
+        {
+            draw.card_index = qMin( m_draw, left );
+            steps.append( draw );
+        }
+
+        if ( isStockPlay( &m ) )
+        {
+            MOVE play = m;
+            play.from = 7;
+            play.card_index = 0;
+            play.turn_index = -1;
+            steps.append( play );
+        }
+    }
+    moves = steps;
+}
+
 void KlondikeSolver::unpack_cluster( unsigned int k )
 {
     /* Get the Out cells from the cluster number. */
@@ -474,6 +622,16 @@ int KlondikeSolver::getOuts()
     return O[0] + O[1] + O[2] + O[3];
 }
 
+/* See Solver::frozen_cards().  Turning a card can only thaw others, it
+takes a card going out to freeze any. */
+
+bool KlondikeSolver::isDeadEnd( const MOVE *m )
+{
+    if ( m && m->totype != O_Type )
+        return false;
+    return frozen_cards( 0, 7, O, false );
+}
+
 KlondikeSolver::KlondikeSolver(const Klondike *dealer, int draw)
     : Solver(), m_draw( draw )
 {
@@ -483,9 +641,29 @@ KlondikeSolver::KlondikeSolver(const Klondike *dealer, int draw)
     Osuit[3] = PS_SPADE;
 
     setNumberPiles( 9 );
+    addSymmetricPiles( 0, 7 );
     deal = dealer;
 }
 
+/* Deal like Klondike::restart(). */
+
+void KlondikeSolver::deal_layout( int dealNumber )
+{
+    DealDeck cards( dealNumber );
+
+    clear_layout();
+    for ( int round = 0; round < 7; ++round )
+        for ( int i = round; i < 7; ++i )
+            deal_card( i, cards.takeLast(), i == round );
+
+    while ( !cards.isEmpty() )
+        deal_card( 8, cards.takeFirst(), false );
+
+    for ( int i = 0; i < 4; ++i )
+        O[i] = NONE;
+}
+
+#ifndef PATSOLVE_HEADLESS
 /* Read a layout file.  Format is one pile per line, bottom to top (visible
 card).  Temp cells and Out on the last two lines, if any. */
 
@@ -526,6 +704,7 @@ void KlondikeSolver::translate_layout()
     }
 
 }
+#endif
 
 unsigned int KlondikeSolver::getClusterNumber()
 {
@@ -536,18 +715,21 @@ unsigned int KlondikeSolver::getClusterNumber()
     return k;
 }
 
+#ifndef PATSOLVE_HEADLESS
 MoveHint KlondikeSolver::translateMove( const MOVE &m )
 {
     PatPile *frompile = 0;
-    if ( m.from == 8 && m.to == 7 )
+    // The deck is clicked, the card it brings up is only played then.
+    if ( m.from >= 8 || ( m.totype == W_Type && m.to >= 8 ) )
         return MoveHint();
-    Q_ASSERT( m.from != 8 );
     if ( m.from == 7 )
         frompile = deal->pile;
     else
         frompile = deal->play[m.from];
 
-    KCard *card = frompile->at( frompile->count() - m.card_index - 1);
+    KCard *card = moved_card( frompile, m );
+    if ( !card )
+        return MoveHint();
 
     if ( m.totype == O_Type )
     {
@@ -577,6 +759,7 @@ MoveHint KlondikeSolver::translateMove( const MOVE &m )
             return MoveHint( card, deal->play[m.to], m.pri );
     }
 }
+#endif
 
 void KlondikeSolver::print_layout()
 {
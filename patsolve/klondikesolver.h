@@ -32,10 +32,16 @@ public:
     virtual void make_move(MOVE *m);
     virtual void undo_move(MOVE *m);
     virtual int getOuts();
+    virtual bool isDeadEnd( const MOVE *m );
     virtual unsigned int getClusterNumber();
-    virtual void translate_layout();
     virtual void unpack_cluster( unsigned int k );
+    virtual void deal_layout( int dealNumber );
+    virtual void expand_moves( QList<MOVE> & moves );
+    virtual Solver *clone() const { return new KlondikeSolver( *this ); }
+#ifndef PATSOLVE_HEADLESS
+    virtual void translate_layout();
     virtual MoveHint translateMove(const MOVE &m);
+#endif
 
     virtual void print_layout();
 
@@ -46,6 +52,10 @@ public:
 
     const Klondike *deal;
     int m_draw;
+
+private:
+    int stock_moves( MOVE *mp, int max, int first_empty_pile );
+    static bool isStockPlay( const MOVE *m );
 };
 
 #endif // KLONDIKESOLVER_H
@@ -28,19 +28,47 @@
 
 
 #define BLOCKSIZE (32 * 4096)
+#define VSTART 4096     /* initial number of slots, a power of two */
+#define LEASE (2 * BLOCKSIZE)   /* least taken from a shared budget */
+
+MemoryManager::MemoryManager()
+    : Pilebytes( 0 ),
+      Nodebytes( 0 ),
+      Mem_limit( 30 * 1000 * 1000 ),
+      Mem_used( 0 ),
+      Mem_peak( 0 ),
+      m_budget( 0 ),
+      m_backend( HashBackend ),
+      Block( 0 ),
+      Visited( 0 ),
+      Vsize( 0 ),
+      Vcount( 0 ),
+      m_saved( false ),
+      Saved( 0 ),
+      Ssize( 0 ),
+      Scount( 0 ),
+      Smark( 0 ),
+      Sptr( 0 )
+{
+	memset(Treelist, 0, sizeof(Treelist));
+}
+
+void MemoryManager::setBackend( Backend backend )
+{
+	m_backend = backend;
+	Nodebytes = backend == TreeBackend ? sizeof(TREE) : 0;
+}
 
 /* Add it to the binary tree for this cluster.  The piles are stored
 following the TREE structure. */
 
-size_t MemoryManager::Mem_remain = 30 * 1000 * 1000;
-
 MemoryManager::inscode MemoryManager::insert_node(TREE *n, int d, TREE **tree, TREE **node)
 {
         int c;
 	quint8 *key, *tkey;
 	TREE *t;
 
-	key = (quint8 *)n + sizeof(TREE);
+	key = node_key(n);
 	n->depth = d;
 	n->left = n->right = NULL;
 	*node = n;
@@ -50,7 +78,7 @@ MemoryManager::inscode MemoryManager::insert_node(TREE *n, int d, TREE **tree, T
 		return NEW;
 	}
 	while (1) {
-		tkey = (quint8 *)t + sizeof(TREE);
+		tkey = node_key(t);
 		c = memcmp(key, tkey, Pilebytes);
 		if (c == 0) {
 			break;
@@ -77,15 +105,123 @@ MemoryManager::inscode MemoryManager::insert_node(TREE *n, int d, TREE **tree, T
         return FOUND;
 }
 
-/* Given a cluster number, return a tree.  There are 14^4 possible
-clusters, but we'll only use a few hundred of them at most.  Hash on
-the cluster number, then locate its tree, creating it if necessary. */
+/* Mix the high bits of the position hash into the low ones before masking,
+the table index only uses the low bits. */
 
-#define TBUCKETS 499    /* a prime */
+static inline size_t visited_slot(quint32 hash, size_t mask)
+{
+	hash ^= hash >> 16;
+	hash *= 0x7feb352d;
+	hash ^= hash >> 15;
+	return hash & mask;
+}
 
-TREELIST *Treelist[TBUCKETS];
+/* Look the position up in the visited set and add it if it is new.  The
+contract is the same as for insert_node(), the tree backend is simply
+forwarded there. */
+
+MemoryManager::inscode MemoryManager::insert_visited(TREE *n, unsigned int cluster, quint32 hash, int d, TREE **node)
+{
+	size_t i, mask;
+	quint8 *key;
+	VISITED *v;
 
-/* Clusters are also stored in a hashed array. */
+	if (m_backend == TreeBackend) {
+		TREELIST *tl = cluster_tree(cluster);
+		if (tl == NULL) {
+			return ERR;
+		}
+		return insert_node(n, d, &tl->tree, node);
+	}
+
+	*node = n;
+
+	/* Keep the load below 3/4.  If there is no memory left to grow,
+	go on filling the table up to 7/8, beyond that the probe chains get
+	too long to be worth it. */
+
+	if ((Vcount + 1) * 4 > Vsize * 3 && !grow_visited() && (Vcount + 1) * 8 > Vsize * 7) {
+		return ERR;
+	}
+
+	key = node_key(n);
+	mask = Vsize - 1;
+	for (i = visited_slot(hash, mask); ; i = (i + 1) & mask) {
+		v = &Visited[i];
+		if (v->node == NULL) {
+			v->hash = hash;
+			v->cluster = cluster;
+			v->node = n;
+			Vcount++;
+			return NEW;
+		}
+		if (v->hash == hash && v->cluster == cluster &&
+		    memcmp(key, node_key(v->node), Pilebytes) == 0) {
+			return FOUND;
+		}
+	}
+}
+
+/* Return the stored nodes with this hash and cluster one after the other,
+NULL when there are no more.  *probe has to be 0 for the first call. */
+
+TREE *MemoryManager::next_visited(quint32 hash, unsigned int cluster, size_t *probe)
+{
+	size_t i, mask;
+	VISITED *v;
+
+	if (Visited == NULL) {
+		return NULL;
+	}
+
+	mask = Vsize - 1;
+	for (i = (visited_slot(hash, mask) + *probe) & mask; ; i = (i + 1) & mask) {
+		v = &Visited[i];
+		++*probe;
+		if (v->node == NULL) {
+			return NULL;
+		}
+		if (v->hash == hash && v->cluster == cluster) {
+			return v->node;
+		}
+	}
+}
+
+/* Double the visited set.  The stored hashes make this a plain copy, the
+keys themselves are never touched. */
+
+bool MemoryManager::grow_visited(void)
+{
+	size_t i, j, size, mask;
+	VISITED *table;
+
+	size = Vsize ? Vsize * 2 : VSTART;
+	table = (VISITED *)allocate_memory(size * sizeof(VISITED));
+	if (table == NULL) {
+		return false;
+	}
+
+	mask = size - 1;
+	for (i = 0; i < Vsize; i++) {
+		if (Visited[i].node == NULL) {
+			continue;
+		}
+		for (j = visited_slot(Visited[i].hash, mask); table[j].node; j = (j + 1) & mask)
+			;
+		table[j] = Visited[i];
+	}
+
+	if (Visited) {
+		free_array(Visited, Vsize);
+	}
+	Visited = table;
+	Vsize = size;
+
+	return true;
+}
+
+/* Hash on the cluster number, then locate its tree, creating it if
+necessary. */
 
 void MemoryManager::init_clusters(void)
 {
@@ -115,7 +251,7 @@ TREELIST *MemoryManager::cluster_tree(unsigned int cluster)
 	/* If we didn't find it, make a new one and add it to the list. */
 
 	if (tl == NULL) {
-		tl = mm_allocate(TREELIST);
+		tl = (TREELIST *)allocate_memory(sizeof(TREELIST));
 		if (tl == NULL) {
 			return NULL;
 		}
@@ -138,13 +274,13 @@ BLOCK *MemoryManager::new_block(void)
 {
 	BLOCK *b;
 
-	b = mm_allocate(BLOCK);
+	b = (BLOCK *)allocate_memory(sizeof(BLOCK));
 	if (b == NULL) {
 		return NULL;
 	}
-	b->block = new_array(quint8, BLOCKSIZE);
+	b->block = (quint8 *)allocate_memory(BLOCKSIZE);
 	if (b->block == NULL) {
-                MemoryManager::free_ptr(b);
+                free_ptr(b);
 		return NULL;
 	}
 	b->ptr = b->block;
@@ -157,18 +293,23 @@ BLOCK *MemoryManager::new_block(void)
 /* Like new(), only from the current block.  Make a new block if necessary. */
 
 quint8 *MemoryManager::new_from_block(size_t s)
+{
+	return new_from_chain(&Block, s);
+}
+
+quint8 *MemoryManager::new_from_chain(BLOCK **chain, size_t s)
 {
 	quint8 *p;
 	BLOCK *b;
 
-	b = Block;
-	if (s > b->remain) {
+	b = *chain;
+	if (b == NULL || s > b->remain) {
 		b = new_block();
 		if (b == NULL) {
 			return NULL;
 		}
-		b->next = Block;
-		Block = b;
+		b->next = *chain;
+		*chain = b;
 	}
 
 	p = b->ptr;
@@ -194,16 +335,39 @@ void MemoryManager::give_back_block(quint8 *p)
 }
 
 void MemoryManager::free_blocks(void)
+{
+	free_chain(&Block);
+}
+
+/* Empty a chain.  The newest block is rewound rather than freed, so a
+chain that is refilled right away doesn't go back to malloc() for it.
+Nothing in the blocks is touched. */
+
+void MemoryManager::reset_chain(BLOCK **chain)
+{
+	BLOCK *b;
+
+	b = *chain;
+	if (b == NULL) {
+		return;
+	}
+	free_chain(&b->next);
+	b->ptr = b->block;
+	b->remain = BLOCKSIZE;
+}
+
+void MemoryManager::free_chain(BLOCK **chain)
 {
 	BLOCK *b, *next;
 
-	b = Block;
+	b = *chain;
 	while (b) {
 		next = b->next;
-                MemoryManager::free_array(b->block, BLOCKSIZE);
-                MemoryManager::free_ptr(b);
+                free_array(b->block, BLOCKSIZE);
+                free_ptr(b);
 		b = next;
 	}
+	*chain = NULL;
 }
 
 void MemoryManager::free_clusters(void)
@@ -211,23 +375,100 @@ void MemoryManager::free_clusters(void)
 	int i;
 	TREELIST *l, *n;
 
+	drop_saved();
+	if (Visited) {
+		free_array(Visited, Vsize);
+		Visited = NULL;
+	}
+	Vsize = Vcount = 0;
+
 	for (i = 0; i < TBUCKETS; i++) {
 		l = Treelist[i];
 		while (l) {
 			n = l->next;
-                        MemoryManager::free_ptr(l);
+                        free_ptr(l);
 			l = n;
 		}
 	}
 }
 
+/* Nothing is ever taken out of the visited set or the blocks, only added,
+so going back is dropping what came since: the table of then and the blocks
+newer than Smark. */
+
+bool MemoryManager::save_visited(bool keep)
+{
+	drop_saved();
+
+	Saved = Visited;
+	Ssize = Vsize;
+	Scount = Vcount;
+	if (keep && Vsize) {
+		Visited = (VISITED *)allocate_memory(Vsize * sizeof(VISITED));
+		if (Visited == NULL) {
+			Visited = Saved;
+			Saved = NULL;
+			return false;
+		}
+		memcpy(Visited, Saved, Vsize * sizeof(VISITED));
+	} else if (!keep) {
+		Visited = NULL;
+		Vsize = Vcount = 0;
+	}
+	Smark = Block;
+	Sptr = Block ? Block->ptr : NULL;
+	m_saved = true;
+
+	return true;
+}
+
+bool MemoryManager::restore_visited(void)
+{
+	BLOCK *next;
+
+	if (!m_saved) {
+		return false;
+	}
+
+	if (Visited && Visited != Saved) {
+		free_array(Visited, Vsize);
+	}
+	Visited = Saved;
+	Vsize = Ssize;
+	Vcount = Scount;
+	Saved = NULL;
+
+	while (Block != Smark) {
+		next = Block->next;
+		free_array(Block->block, BLOCKSIZE);
+		free_ptr(Block);
+		Block = next;
+	}
+	if (Block) {
+		Block->ptr = Sptr;
+		Block->remain = BLOCKSIZE - (Sptr - Block->block);
+	}
+	m_saved = false;
+
+	return true;
+}
+
+void MemoryManager::drop_saved(void)
+{
+	if (Saved && Saved != Visited) {
+		free_array(Saved, Ssize);
+	}
+	Saved = NULL;
+	m_saved = false;
+}
+
 /* Allocate some space and return a pointer to it.  See new() in util.h. */
 
 void *MemoryManager::allocate_memory(size_t s)
 {
 	void *x;
 
-	if (s > Mem_remain) {
+	if (Mem_used + s > Mem_limit && !lease(Mem_used + s - Mem_limit)) {
 		return NULL;
 	}
 
@@ -236,6 +477,47 @@ void *MemoryManager::allocate_memory(size_t s)
 	}
 
         memset( x, 0, s );
-	Mem_remain -= s;
+	Mem_used += s;
+	if (Mem_used > Mem_peak) {
+		Mem_peak = Mem_used;
+	}
 	return x;
 }
+
+void MemoryManager::share(MemoryBudget *budget, size_t limit)
+{
+	m_budget = budget;
+	if (budget) {
+		QMutexLocker lock(&budget->mutex);
+		budget->used += Mem_used;
+		Mem_limit = Mem_used;
+	} else {
+		Mem_limit = limit;
+	}
+}
+
+/* Take at least s more bytes from the shared budget, if there is one. */
+
+bool MemoryManager::lease(size_t s)
+{
+	size_t grant;
+
+	if (m_budget == NULL) {
+		return false;
+	}
+
+	QMutexLocker lock(&m_budget->mutex);
+	if (m_budget->used + s > m_budget->limit) {
+		return false;
+	}
+
+	/* Don't let one manager hoard what the others still need. */
+
+	grant = qMax(s, qMin((size_t)LEASE, (m_budget->limit - m_budget->used) / 16));
+	m_budget->used += grant;
+	if (m_budget->used > m_budget->limit - m_budget->limit / 8) {
+		m_budget->nearlyFull.store(1);
+	}
+	Mem_limit += grant;
+	return true;
+}
@@ -22,6 +22,10 @@
 #include <stdlib.h>
 #include <sys/types.h>
 
+#include <QtCore/QAtomicInt>
+#include <QtCore/QMutex>
+#include <QtCore/QtGlobal>
+
 struct TREE;
 
 /* Memory. */
@@ -56,43 +60,140 @@ struct TREE {
 #undef ERR
 #endif
 
+/* Given a cluster number, return a tree.  There are 14^4 possible
+clusters, but we'll only use a few hundred of them at most. */
+
+#define TBUCKETS 499    /* a prime */
+
+/* The alternative to the cluster trees: one open addressing table for all
+positions, probed linearly.  Each slot keeps the hash and the cluster next
+to the node pointer, so a probe only touches the packed key when both
+match.  The nodes need no header then, the key starts right at the node. */
+
+struct VISITED {
+	quint32 hash;
+	unsigned int cluster;
+	TREE *node;
+};
+
+/* A memory limit several memory managers draw on, see
+MemoryManager::share().  Each one takes what it needs in leases of a few
+blocks, so the lock is seldom taken.  The leases are never given back, once
+nearly full the budget stays so. */
+
+struct MemoryBudget
+{
+    MemoryBudget() : limit( 0 ), used( 0 ) {}
+
+    QMutex mutex;
+    size_t limit;
+    size_t used;            /* leased so far */
+    QAtomicInt nearlyFull;  /* less than an eighth left */
+};
+
 class MemoryManager
 {
 public:
     enum inscode { NEW, FOUND, ERR };
+    enum Backend { TreeBackend, HashBackend };
+
+    MemoryManager();
+
+    /* Only change the backend between two searches. */
+    void setBackend( Backend backend );
+    Backend backend() const { return m_backend; }
 
     unsigned char *new_from_block(size_t s);
     void init_clusters(void);
     void free_blocks(void);
+
+    /* The same bump allocation for other users, each with a chain of
+       blocks of its own.  A chain starts out as NULL.  reset_chain()
+       keeps one block to start over with, free_chain() gives it all
+       back. */
+    unsigned char *new_from_chain(BLOCK **chain, size_t s);
+    void reset_chain(BLOCK **chain);
+    void free_chain(BLOCK **chain);
+
     void free_clusters(void);
+
+    /* Set the visited set and the blocks aside as they are now, so
+       restore_visited() can go back to them after a search that didn't
+       come to an end.  With keep the search goes on with a copy of the
+       visited set, else with an empty one.  drop_saved() keeps what the
+       search did instead, free_clusters() too.  Only for the hash
+       backend; false if there is no memory for the copy. */
+    bool save_visited(bool keep);
+    bool restore_visited(void);
+    void drop_saved(void);
+
     TREELIST *cluster_tree(unsigned int cluster);
     inscode insert_node(TREE *n, int d, TREE **tree, TREE **node);
+    inscode insert_visited(TREE *n, unsigned int cluster, quint32 hash, int d, TREE **node);
+    TREE *next_visited(quint32 hash, unsigned int cluster, size_t *probe);
+    quint8 *node_key(TREE *n) const { return (quint8 *)n + Nodebytes; }
     void give_back_block(unsigned char *p);
     void init_buckets( int i );
     BLOCK *new_block(void);
 
     template<class T>
-    static void free_ptr(T *ptr) {
-        free(ptr); Mem_remain += sizeof(T);
+    void free_ptr(T *ptr) {
+        free(ptr); Mem_used -= sizeof(T);
     }
 
     template<class T>
-    static void free_array(T *ptr, size_t size) {
+    void free_array(T *ptr, size_t size) {
         free(ptr);
-        Mem_remain += size * sizeof(T);
+        Mem_used -= size * sizeof(T);
     }
 
-    static void *allocate_memory(size_t s);
+    void *allocate_memory(size_t s);
+
+    /* Draw on budget from now on, what is used already counts against
+       it.  share(0, limit) goes back to a limit of our own. */
+    void share(MemoryBudget *budget, size_t limit = 0);
+
+    /* Is less than an eighth of the budget left? */
+    bool nearly_full() const {
+        return m_budget ? m_budget->nearlyFull.load() != 0
+                        : Mem_used > Mem_limit - Mem_limit / 8;
+    }
 
     // ugly hack
     int Pilebytes;
-    static size_t Mem_remain;
+    size_t Nodebytes;       /* header in front of every packed key */
+
+    /* Everything is allocated through allocate_memory(), the blocks as
+       a whole, so this is what the search really holds. */
+    size_t Mem_limit;       /* the budget */
+    size_t Mem_used;
+    size_t Mem_peak;        /* highest Mem_used since the last reset */
 private:
+    bool grow_visited(void);
+    bool lease(size_t s);
+
+    MemoryBudget *m_budget;
+    Backend m_backend;
     BLOCK *Block;
 
+    /* Clusters are stored in a hashed array. */
+    TREELIST *Treelist[TBUCKETS];
+
+    VISITED *Visited;
+    size_t Vsize;           /* always a power of two */
+    size_t Vcount;
+
+    /* What save_visited() set aside. */
+    bool m_saved;
+    VISITED *Saved;
+    size_t Ssize;
+    size_t Scount;
+    BLOCK *Smark;           /* the newest block then */
+    unsigned char *Sptr;    /* and how far it was used */
 };
 
-#define new_array( type, size ) ( type* )MemoryManager::allocate_memory( ( size )*sizeof( type ) );
-#define mm_allocate( type ) ( type* )MemoryManager::allocate_memory( sizeof( type ) );
+/* Both expect a MemoryManager *mm in scope. */
+#define new_array( type, size ) ( type* )mm->allocate_memory( ( size )*sizeof( type ) );
+#define mm_allocate( type ) ( type* )mm->allocate_memory( sizeof( type ) );
 
 #endif // MEMORY_H
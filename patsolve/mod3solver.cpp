@@ -17,7 +17,9 @@
 
 #include "mod3solver.h"
 
+#ifndef PATSOLVE_HEADLESS
 #include "../mod3.h"
+#endif
 
 #include <QDebug>
 
@@ -120,7 +122,7 @@ void Mod3Solver::undo_move(MOVE *m)
         int len = m->card_index;
         if ( len > 8 )
             len = 8;
-        for ( int i = len; i >= 0; i-- )
+        for ( int i = len - 1; i >= 0; i-- )
         {
             card_t card = *Wp[24+i];
             Wlen[deck]++;
@@ -336,6 +338,18 @@ int Mod3Solver::getOuts()
     return ret;
 }
 
+/* The cards on the three rows of targets, in steps of 16.  Counting every
+card, or every row apart, starts a new cluster with nearly every move to
+the targets and solve() then goes depth first for too long. */
+
+unsigned int Mod3Solver::getClusterNumber()
+{
+    int k = 0;
+    for ( int i = 0; i < 8 * 3; i++ )
+        k += Wlen[i];
+    return k / 16;
+}
+
 Mod3Solver::Mod3Solver(const Mod3 *dealer)
     : Solver()
 {
@@ -344,6 +358,24 @@ Mod3Solver::Mod3Solver(const Mod3 *dealer)
     deal = dealer;
 }
 
+/* Deal like Mod3::restart(): everything goes to the talon, then the
+rows are dealt from its top. */
+
+void Mod3Solver::deal_layout( int dealNumber )
+{
+    DealDeck cards( dealNumber, 2 );
+
+    clear_layout();
+    for ( int w = 0; w < 4 * 8; ++w )
+        deal_card( w, cards.takeLast() );
+
+    aces = 4 * 8;
+    deck = aces + 1;
+    while ( !cards.isEmpty() )
+        deal_card( deck, cards.takeFirst(), false );
+}
+
+#ifndef PATSOLVE_HEADLESS
 /* Read a layout file.  Format is one pile per line, bottom to top (visible
 card).  Temp cells and Out on the last two lines, if any. */
 
@@ -379,11 +411,13 @@ void Mod3Solver::translate_layout()
 
 MoveHint Mod3Solver::translateMove( const MOVE & m )
 {
-    if ( m.from == deck )
+    if ( m.from >= aces || ( m.to > aces ) )
         return MoveHint();
 
     PatPile *frompile = deal->stack[m.from / 8][m.from % 8];
     KCard *card = frompile->topCard();
+    if ( !card )
+        return MoveHint();
 
     if ( m.to == aces )
     {
@@ -392,6 +426,7 @@ MoveHint Mod3Solver::translateMove( const MOVE & m )
         return MoveHint( card, deal->stack[m.to / 8][m.to % 8], m.pri );
     }
 }
+#endif
 
 void Mod3Solver::print_layout()
 {
@@ -31,8 +31,13 @@ public:
     virtual void make_move(MOVE *m);
     virtual void undo_move(MOVE *m);
     virtual int getOuts();
+    virtual unsigned int getClusterNumber();
+    virtual void deal_layout( int dealNumber );
+    virtual Solver *clone() const { return new Mod3Solver( *this ); }
+#ifndef PATSOLVE_HEADLESS
     virtual void translate_layout();
     virtual MoveHint translateMove(const MOVE &m);
+#endif
 
     virtual void print_layout();
 
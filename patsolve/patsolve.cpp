@@ -18,13 +18,20 @@
 
 #include "patsolve.h"
 
+#ifndef PATSOLVE_HEADLESS
 #include "../patpile.h"
 
 #include "KCardDeck"
+#endif
 
 #include <QDebug>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QAtomicPointer>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QThread>
 
 #include <cctype>
+#include <climits>
 #include <cmath>
 #include <cstdarg>
 #include <cstdlib>
@@ -37,7 +44,46 @@
 #undef ERR
 #endif
 
-long all_moves = 0;
+/* What the workers of a parallel search share.  Each worker has its own
+work arrays, position blocks and queues, see parallel_doit().  The visited
+set is split by the position hash and the pile dictionary has a lock for
+every few buckets, so the workers seldom wait for each other. */
+
+#define VSHARDS 8               /* parts of the visited set */
+#define VSHARD(hash) ((hash) >> 29)
+#define PILELOCKS 64            /* locks of the dictionary buckets */
+
+struct ParallelSearch
+{
+    Solver *master;                 /* owns the pile dictionary */
+    QList<Solver*> participants;    /* the workers, clones of the master */
+    MemoryBudget budget;            /* the memory limit of the master */
+    MemoryManager visited[VSHARDS]; /* the shared visited set */
+    QMutex visitedMutex[VSHARDS];
+    QMutex bucketMutex[PILELOCKS];
+    QMutex pileMutex;               /* for adding piles */
+    QAtomicInt pending;             /* positions queued or being solved */
+    QAtomicInt stop;                /* somebody won or gave up */
+    QAtomicPointer<Solver> winner;  /* the first worker that won */
+};
+
+class SearchWorker : public QThread
+{
+public:
+    explicit SearchWorker( Solver *solver )
+      : m_solver( solver )
+    {
+    }
+
+protected:
+    virtual void run()
+    {
+        m_solver->work();
+    }
+
+private:
+    Solver *m_solver;
+};
 
 /* This is a 32 bit FNV hash.  For more information, see
 http://www.isthe.com/chongo/tech/comp/fnv/index.html */
@@ -62,27 +108,50 @@ static inline quint32 fnv_hash_buf(quint8 *s, int len)
 	return h;
 }
 
-/* Hash a 0 terminated string. */
+/* Piles are hashed Zobrist style: every (height, card) pair has a random
+looking code and the pile hash is the XOR of the codes of its cards.  The
+codes are computed rather than looked up, a table would not fit into the L1
+cache. */
 
-static inline quint32 fnv_hash_str(quint8 *s)
-{
-	quint32 h;
+#define PILESIZE 84             /* room in each work pile */
 
-	h = FNV1_32_INIT;
-	while (*s) {
-		h = fnv_hash(*s++, h);
-	}
+static inline quint32 zobrist(int i, card_t card)
+{
+	quint32 x = ((quint32)i << 8 | card) * 0x9E3779B1;
 
-	return h;
+	x ^= x >> 15;
+	x *= 0x85EBCA77;
+	x ^= x >> 13;
+	return x;
 }
 
+/* Spread a pile hash depending on where the pile is, so the position hash
+changes when two piles swap places.  The position hash adds them up rather
+than XORing them, symmetric piles all mix in at the same place and two equal
+ones must not cancel out. */
+
+static inline quint32 pile_mix(quint32 hash, int w)
+{
+	return (hash + (quint32)w * 0x9E3779B9) * FNV_32_PRIME;
+}
 
 /* Hash a pile. */
 
 void Solver::hashpile(int w)
 {
+	int i, n;
+	quint32 h;
+
    	W[w][Wlen[w]] = 0;
-	Whash[w] = fnv_hash_str(W[w]);
+
+	n = Wlen[w];
+	h = 0;
+	for (i = 0; i < n; i++) {
+		h ^= zobrist(i, W[w][i]);
+	}
+
+	Poshash += pile_mix(h, Wmix[w]) - pile_mix(Whash[w], Wmix[w]);
+	Whash[w] = h;
 
 	/* Invalidate this pile's id.  We'll calculate it later. */
 
@@ -91,6 +160,12 @@ void Solver::hashpile(int w)
 
 #define MAXDEPTH 400
 
+#define NBUCKETS 65521           /* the largest 16 bit prime */
+#define NPILES   (1 << 26)       /* room in the reverse lookup */
+#define PILEPAGE 1024            /* ids in a page of the reverse lookup */
+
+#define PILE_ENTRY(id) (Pilebucket[(id) / PILEPAGE][(id) % PILEPAGE])
+
 bool Solver::recursive(POSITION *parent)
 {
     int i, alln, a, numout = 0;
@@ -100,7 +175,7 @@ bool Solver::recursive(POSITION *parent)
         recu_pos.clear();
         delete Stack;
         Stack = new POSITION[MAXDEPTH];
-        memset( Stack, 0, sizeof( POSITION ) * MAXDEPTH );
+        memset( (void *)Stack, 0, sizeof( POSITION ) * MAXDEPTH );
     }
 
     /* Fill in the Possible array. */
@@ -167,7 +242,7 @@ bool Solver::recursive(POSITION *parent)
         pos->queue = NULL;
         pos->parent = parent;
         pos->node = pack_position();
-        quint8 *key = (quint8 *)pos->node + sizeof(TREE);
+        quint8 *key = mm->node_key(pos->node);
 #if 0
         qint32 hash = fnv_hash_buf(key, mm->Pilebytes);
         if ( recu_pos.contains( hash ) )
@@ -180,7 +255,7 @@ bool Solver::recursive(POSITION *parent)
 #else
         for ( int i = 0; i < depth; ++i )
         {
-            quint8 *tkey = (quint8 *)Stack[i].node + sizeof(TREE);
+            quint8 *tkey = mm->node_key(Stack[i].node);
             if ( !memcmp( key, tkey, mm->Pilebytes ) )
             {
                 key = 0;
@@ -201,7 +276,7 @@ bool Solver::recursive(POSITION *parent)
         pos->move = *mp;                 /* struct copy */
         pos->cluster = 0;
         pos->depth = depth;
-        pos->nchild = 0;
+        pos->nchild.store(0);
 
         bool ret = recursive(pos);
         fit |= ret;
@@ -211,7 +286,7 @@ bool Solver::recursive(POSITION *parent)
             break;
     }
 
-    MemoryManager::free_array(mp0, alln);
+    mm->free_array(mp0, alln + 1);
 
     if ( parent == NULL ) {
         printf( "Total %ld\n", Total_generated );
@@ -222,7 +297,8 @@ bool Solver::recursive(POSITION *parent)
 }
 
 
-/* Generate an array of the moves we can make from this position. */
+/* Generate an array of the moves we can make from this position.  NULL
+if there are none, or with *nmoves -1 if there is no memory for them. */
 
 MOVE *Solver::get_moves(int *nmoves)
 {
@@ -253,6 +329,7 @@ MOVE *Solver::get_moves(int *nmoves)
 	if (n == 0) {
             /* No more moves - won or lost */
             //print_layout();
+            *nmoves = 0;
             return NULL;
 	}
 
@@ -271,6 +348,7 @@ MOVE *Solver::get_moves(int *nmoves)
 
 	mp = mp0 = new_array(MOVE, n);
 	if (mp == NULL) {
+		*nmoves = -1;
 		return NULL;
 	}
 	*nmoves = n;
@@ -300,11 +378,6 @@ MOVE *Solver::get_moves(int *nmoves)
 	return mp0;
 }
 
-/* Test the current position to see if it's new (or better).  If it is, save
-it, along with the pointer to its parent and the move we used to get here. */
-
-int Posbytes;
-
 /* Comparison function for sorting the W piles. */
 
 int Solver::wcmp(int a, int b)
@@ -332,85 +405,223 @@ void Solver::pilesort(void)
         //fprintf( stderr, "\n" );
 }
 
-#define NBUCKETS 65521           /* the largest 16 bit prime */
-#define NPILES   65536           /* a 16 bit code */
-
-typedef struct bucketlist {
-	quint8 *pile;           /* 0 terminated copy of the pile */
-	quint32 hash;         /* the pile's hash code */
-	int pilenum;            /* the unique id for this pile */
-	struct bucketlist *next;
-} BUCKETLIST;
-
-BUCKETLIST *Bucketlist[NBUCKETS];
-int Pilenum;                    /* the next pile number to be assigned */
-
-BUCKETLIST *Pilebucket[NPILES]; /* reverse lookup for unpack to get the bucket
-				   from the pile */
-
 /* Compact position representation.  The position is stored as an
 array with the following format:
 	pile0# pile1# ... pileN# (N = Nwpiles)
-where each pile number is packed into 16 bits (so a pile take 2 bytes).
-Positions in this format are unique can be compared with memcmp().  The O
-cells are encoded as a cluster number: no two positions with different
-cluster numbers can ever be the same, so we store different clusters in
-different trees.  */
+where each pile number takes Pilewidth bytes, low byte first.  Two bytes
+are enough for almost every search, longer ones widen the numbers to three
+and then four bytes, see widen_search().  The numbers of symmetric piles
+are sorted, see sort_symmetric(), and the POSITION keeps where they came
+from.  Positions in this format are unique can be compared with memcmp().
+The O cells are encoded as a cluster number: no two positions with
+different cluster numbers can ever be the same, so we store different
+clusters in different trees (or compare the cluster along with the key in
+the visited set).  */
+
+static inline void put_pile_id(quint8 *p, int width, quint32 id)
+{
+	switch (width) {
+	case 4:
+		p[3] = id >> 24;
+		/* fall through */
+	case 3:
+		p[2] = id >> 16;
+		/* fall through */
+	default:
+		p[1] = id >> 8;
+		p[0] = id;
+	}
+}
 
-int Treebytes;
+static inline int get_pile_id(const quint8 *p, int width)
+{
+	quint32 id = p[0] | p[1] << 8;
+
+	switch (width) {
+	case 4:
+		id |= (quint32)p[3] << 24;
+		/* fall through */
+	case 3:
+		id |= p[2] << 16;
+	}
+	return id;
+}
 
 TREE *Solver::pack_position(void)
 {
-	int j, k, w;
+	int j, w;
+	int ids[MAXSYM];
 	quint8 *p;
 	TREE *node;
 
-	/* Allocate space and store the pile numbers.  The tree node
-	will get filled in later, by insert_node(). */
+	/* Allocate space and store the pile numbers.  The tree node (if
+	the backend uses one) will get filled in later, by insert_node(). */
 
 	p = mm->new_from_block(Treebytes);
 	if (p == NULL) {
-                Status = UnableToDetermineSolvability;
+                Status = MemoryLimitReached;
 		return NULL;
 	}
 	node = (TREE *)p;
-	p += sizeof(TREE);
-
-	/* Pack the pile numers j into bytes p.
-		       j             j
-		+--------+----:----+--------+
-		|76543210|7654:3210|76543210|
-		+--------+----:----+--------+
-		    p         p         p
-	*/
-
-	k = 0;
-        quint16 *p2 = ( quint16* ) p;
-	for (w = 0; w < m_number_piles; ++w) {
+	p = mm->node_key(node);
+
+	for (w = 0; w < m_number_piles; ++w, p += Pilewidth) {
 		j = Wpilenum[w];
                 if ( j < 0 )
                 {
-                    mm->give_back_block( p );
+                    mm->give_back_block( (quint8 *)node );
                     return NULL;
                 }
-                *p2++ = j;
+
+		/* A number too wide for the positions stored so far ends
+		the search, patsolve() starts it over with wider ones. */
+
+		if (Pilewidth < 4 && j >> (8 * Pilewidth)) {
+			mm->give_back_block( (quint8 *)node );
+			Widen = true;
+			Status = UnableToDetermineSolvability;
+			return NULL;
+		}
+	}
+
+	sort_symmetric(ids);
+	p = mm->node_key(node);
+	for (w = 0; w < m_number_piles; ++w, p += Pilewidth) {
+		put_pile_id(p, Pilewidth, Wslot[w] < 0 ? Wpilenum[w] : ids[Wslot[w]]);
 	}
 
 	return node;
 }
 
-/* Like strcpy() but return the length of the string. */
+/* Sort the numbers of the piles in every symmetric group into ids, ties
+keep their order.  Worder gets four bits for every slot of ids: the pile
+the number belongs to, counted from the first one of the group.  The
+numbers of all symmetric piles have to be known. */
 
-static inline int strecpy(unsigned char *d, unsigned char *s)
+void Solver::sort_symmetric(int *ids)
 {
-	int i;
+	int g, i, k, n, s, id;
+	bool sort;
+	quint8 from[MAXSYM];
+
+	Worder = 0;
+	sort = Nsym && pilesInterchangeable();
+	for (g = s = 0; g < Nsym; g++, s += n) {
+		n = Symcount[g];
+		for (i = 0; i < n; i++) {
+			id = Wpilenum[Symfirst[g] + i];
+			for (k = i; sort && k > 0 && ids[s + k - 1] > id; k--) {
+				ids[s + k] = ids[s + k - 1];
+				from[k] = from[k - 1];
+			}
+			ids[s + k] = id;
+			from[k] = i;
+		}
+		for (i = 0; i < n; i++) {
+			Worder |= (quint64)from[i] << (4 * (s + i));
+		}
+	}
+}
 
-	i = 0;
-	while ((*d++ = *s++) != '\0') {
-		i++;
+/* Worder of the layout in the work arrays. */
+
+quint64 Solver::pile_order()
+{
+	int ids[MAXSYM];
+
+	sort_symmetric(ids);
+	return Worder;
+}
+
+/* The pile dictionary stores its piles packed.  Two header bytes hold the
+number of cards and the number of face down cards at the bottom of the pile,
+then every card follows with just its six bits of suit and rank, four cards
+in three bytes.  Piles with face down cards further up (the markers on the
+Grandfather foundations, say) keep one byte per card, flagged by PACK_RAW
+in place of the face down count. */
+
+#define PACK_RAW 0xFF
+#define PACKED_MAX (2 + PILESIZE)      /* room for any packed pile */
+
+static int pack_pile(quint8 *d, const card_t *s, int n)
+{
+	int i, k, down, bits;
+	quint32 acc;
+
+	for (down = 0; down < n && (s[down] & 0xC0) == 0x80; down++)
+		;
+	for (i = down; i < n && (s[i] & 0xC0) == 0; i++)
+		;
+	d[0] = n;
+	if (i < n) {
+		d[1] = PACK_RAW;
+		memcpy(d + 2, s, n);
+		return n + 2;
+	}
+	d[1] = down;
+
+	k = 2;
+	acc = bits = 0;
+	for (i = 0; i < n; i++) {
+		acc = (acc << 6) | (s[i] & 0x3F);
+		bits += 6;
+		if (bits >= 8) {
+			bits -= 8;
+			d[k++] = acc >> bits;
+		}
+	}
+	if (bits) {
+		d[k++] = acc << (8 - bits);
+	}
+
+	return k;
+}
+
+static inline int packed_size(const quint8 *s)
+{
+	return 2 + (s[1] == PACK_RAW ? s[0] : (s[0] * 6 + 7) / 8);
+}
+
+/* Unpack into a work pile, 0 terminated like the piles are.  Return the
+number of cards. */
+
+static int unpack_pile(card_t *d, const quint8 *s)
+{
+	int i, n, down, bits;
+	quint32 acc;
+
+	n = s[0];
+	down = s[1];
+	if (down == PACK_RAW) {
+		memcpy(d, s + 2, n);
+	} else {
+		s += 2;
+		acc = bits = 0;
+		for (i = 0; i < n; i++) {
+			if (bits < 6) {
+				acc = (acc << 8) | *s++;
+				bits += 8;
+			}
+			bits -= 6;
+			d[i] = (acc >> bits) & 0x3F;
+			if (i < down) {
+				d[i] |= 1 << 7;
+			}
+		}
 	}
+	d[n] = 0;
+
+	return n;
+}
 
-	return i;
+/* Compare a stored pile with one packed by pack_pile(), which returned
+bytes.  The header decides the size, so the rest is only compared if it
+agrees. */
+
+static inline bool same_pile(const quint8 *pile, const quint8 *key, int bytes)
+{
+	return pile[0] == key[0] && pile[1] == key[1] &&
+	    memcmp(pile + 2, key + 2, bytes - 2) == 0;
 }
 
 /* Unpack a compact position rep.  T cells must be restored from the
@@ -418,34 +629,38 @@ array following the POSITION struct. */
 
 void Solver::unpack_position(POSITION *pos)
 {
-	int i, k, w;
-	quint8 c;
-	BUCKETLIST *l;
+	int w, id;
+	quint8 *p;
 
         unpack_cluster(pos->cluster);
 
-	/* Unpack bytes p into pile numbers j.
-		    p         p         p
-		+--------+----:----+--------+
-		|76543210|7654:3210|76543210|
-		+--------+----:----+--------+
-		       j             j
-	*/
-
-	k = w = i = c = 0;
-	quint16 *p2 = ( quint16* )( (quint8 *)(pos->node) + sizeof(TREE) );
-	while (w < m_number_piles) {
-                i = *p2++;
-		Wpilenum[w] = i;
-		l = Pilebucket[i];
-		i = strecpy(W[w], l->pile);
-		Wp[w] = &W[w][i - 1];
-		Wlen[w] = i;
-		Whash[w] = l->hash;
-		w++;
+	p = mm->node_key(pos->node);
+	for (w = 0; w < m_number_piles; w++, p += Pilewidth) {
+		id = get_pile_id(p, Pilewidth);
+		if (Wslot[w] < 0) {
+			restore_pile(w, id);
+		} else {
+			restore_pile(Wmix[w] + ((pos->order >> (4 * Wslot[w])) & 0xF), id);
+		}
 	}
 }
 
+/* Put the pile with this id into work pile w. */
+
+void Solver::restore_pile(int w, int id)
+{
+	int i;
+	BUCKETLIST *l;
+
+	Wpilenum[w] = id;
+	l = PILE_ENTRY(id);
+	i = unpack_pile(W[w], l->pile);
+	Wp[w] = &W[w][i - 1];
+	Wlen[w] = i;
+	Poshash += pile_mix(l->hash, Wmix[w]) - pile_mix(Whash[w], Wmix[w]);
+	Whash[w] = l->hash;
+}
+
 void Solver::printcard(card_t card, FILE *outfile)
 {
     static char Rank[] = " A23456789TJQK";
@@ -482,7 +697,7 @@ void Solver::win(POSITION *pos)
 
     mpp0 = new_array(MOVE *, nmoves);
     if (mpp0 == NULL) {
-        Status = UnableToDetermineSolvability;
+        Status = MemoryLimitReached;
         return; /* how sad, so close... */
     }
     mpp = mpp0 + nmoves - 1;
@@ -493,25 +708,220 @@ void Solver::win(POSITION *pos)
     for (i = 0, mpp = mpp0; i < nmoves; ++i, ++mpp)
         winMoves.append( **mpp );
 
-    MemoryManager::free_array(mpp0, nmoves);
+    mm->free_array(mpp0, nmoves);
+
+    /* Remember the positions in between, so a retained search knows
+       when the player follows the line. */
+
+    Winline.clear();
+    Winorder.clear();
+    for (p = pos; p; p = p->parent) {
+        Winline.prepend( p->node );
+        Winorder.prepend( p->order );
+    }
 }
 
-/* Initialize the hash buckets. */
+/* A way to a position further down the winning line. */
 
-void Solver::init_buckets(void)
+struct Shortcut
+{
+    int to;                 /* index on Winline */
+    int gain;               /* moves saved */
+    QList<MOVE> moves;
+};
+
+#define SHORTCUT_DEPTH 4
+
+/* Rebuild Winline and Winorder along winMoves from the start, after
+expand_moves() has changed them.  The layouts in between go into the
+visited set like any other.  Without the memory for them the line is
+dropped, and a retained search cannot follow the scene along it. */
+
+void Solver::retrace_line()
 {
 	int i;
+	unsigned int cluster;
+	TREE *node;
+
+	Winline.clear();
+	Winorder.clear();
+	if (mm->backend() != MemoryManager::HashBackend) {
+		return;
+	}
+
+	restore_start();
+	for (i = 0; ; ++i) {
+		if (insert(&cluster, i, &node) == MemoryManager::ERR) {
+			Status = SolutionExists;   /* it still is */
+			Winline.clear();
+			Winorder.clear();
+			return;
+		}
+		Winline.append(node);
+		Winorder.append(pile_order());
+		if (i == winMoves.count()) {
+			break;
+		}
+		make_move(&winMoves[i]);
+	}
+}
 
-	/* Packed positions need 3 bytes for every 2 piles. */
+/* Make the solution shorter: walk down the winning line and try every
+sequence of a few moves from each position on it.  If one of them gets to
+a position further down the line than the line itself does, the moves in
+between are replaced.  The positions are recognized in the visited set, so
+this needs the hash backend and Winline.  The sequences get longer with
+every pass over the line until m_improveMsecs are up. */
 
-	i = ( m_number_piles ) * sizeof( quint16 );
-	i += ( m_number_piles ) & 0x1;
+void Solver::improve_solution()
+{
+	int i, k, depth;
+	unsigned int cluster;
+	bool improved;
+	TREE *node;
+	QList<MOVE> moves;
+	QElapsedTimer timer;
 
-        mm->Pilebytes = i;
+	if (Winline.count() != winMoves.count() + 1 ||
+	    mm->backend() != MemoryManager::HashBackend) {
+		return;
+	}
+	timer.start();
 
-	memset(Bucketlist, 0, sizeof(Bucketlist));
-	Pilenum = 0;
-	Treebytes = sizeof(TREE) + mm->Pilebytes;
+	for (depth = 1; depth <= SHORTCUT_DEPTH; ) {
+		Winindex.clear();
+		for (i = 0; i < Winline.count(); ++i) {
+			Winindex.insert(Winline[i], i);
+		}
+
+		/* Back to the start of the line. */
+
+		restore_start();
+
+		improved = false;
+		for (i = 0; i < winMoves.count(); ++i) {
+			if (timer.hasExpired(m_improveMsecs)) {
+				return;
+			}
+			{
+				QMutexLocker lock( &endMutex );
+				if ( m_shouldEnd )
+					return;
+			}
+
+			Shortcut best;
+			best.to = -1;
+			best.gain = 0;
+			find_shortcut(depth, i, moves, &best);
+
+			if (best.gain > 0) {
+
+				/* The positions along the shortcut need their
+				nodes for Winline, so a retained search can
+				follow it. */
+
+				QList<TREE*> nodes;
+				QList<quint64> orders;
+				for (k = 0; k < best.moves.count() - 1; ++k) {
+					make_move(&best.moves[k]);
+					if (insert(&cluster, i + k + 1, &node) == MemoryManager::ERR) {
+						Status = SolutionExists;   /* it still is */
+						return;
+					}
+					nodes.append(node);
+					orders.append(pile_order());
+				}
+				for (k = best.moves.count() - 2; k >= 0; --k) {
+					undo_move(&best.moves[k]);
+				}
+
+				for (k = i; k < best.to; ++k) {
+					winMoves.removeAt(i);
+				}
+				for (k = i + 1; k < best.to; ++k) {
+					Winline.removeAt(i + 1);
+					Winorder.removeAt(i + 1);
+				}
+				for (k = best.moves.count() - 1; k >= 0; --k) {
+					winMoves.insert(i, best.moves[k]);
+				}
+				for (k = nodes.count() - 1; k >= 0; --k) {
+					Winline.insert(i + 1, nodes[k]);
+					Winorder.insert(i + 1, orders[k]);
+				}
+				Winindex.clear();
+				for (k = 0; k < Winline.count(); ++k) {
+					Winindex.insert(Winline[k], k);
+				}
+				improved = true;
+			}
+
+			make_move(&winMoves[i]);
+		}
+
+		/* Try longer sequences only once the short ones are done. */
+
+		if (!improved) {
+			depth++;
+		}
+	}
+}
+
+/* Try all sequences of up to depth moves from the layout, which is on the
+winning line at start, and remember the one that saves the most moves. */
+
+void Solver::find_shortcut(int depth, int start, QList<MOVE> &moves, Shortcut *best)
+{
+	int j, gain, nmoves;
+	MOVE *mp, *mp0;
+	TREE *node;
+
+	if ((mp0 = get_moves(&nmoves)) == NULL) {
+		return;
+	}
+	for (mp = mp0; mp < mp0 + nmoves; ++mp) {
+		make_move(mp);
+		moves.append(*mp);
+
+		/* The line has to go on with its piles in the same
+		order. */
+
+		node = find_visited(mm, getClusterNumber());
+		j = node ? Winindex.value(node, -1) : -1;
+		if (j >= 0 && pile_order() != Winorder[j]) {
+			j = -1;
+		}
+		gain = j - start - moves.count();
+		if (gain > best->gain) {
+			best->to = j;
+			best->gain = gain;
+			best->moves = moves;
+		}
+		if (moves.count() < depth) {
+			find_shortcut(depth, start, moves, best);
+		}
+
+		moves.removeLast();
+		undo_move(mp);
+	}
+	mm->free_array(mp0, nmoves);
+}
+
+/* Initialize the hash buckets. */
+
+void Solver::init_buckets(void)
+{
+	free_buckets();
+	set_pile_width(2);
+}
+
+/* Packed positions need width bytes for every pile. */
+
+void Solver::set_pile_width(int width)
+{
+	Pilewidth = width;
+        mm->Pilebytes = m_number_piles * width;
+	Treebytes = mm->Nodebytes + mm->Pilebytes;
 
 	/* In order to keep the TREE structure aligned, we need to add
 	up to 7 bytes on Alpha or 3 bytes on Intel -- but this is still
@@ -540,21 +950,38 @@ identifiers. */
 
 int Solver::get_pilenum(int w)
 {
-	int bucket, pilenum;
-	BUCKETLIST *l, *last;
+	int bucket, pilenum, bytes;
+	BUCKETLIST *l, *last, **page;
+	BUCKETHEAD *head;
+	quint8 key[PACKED_MAX];
 
 	/* For a given pile, get its unique pile id.  If it doesn't have
 	one, add it to the appropriate list and give it one.  First, get
 	the hash bucket. */
 
 	bucket = Whash[w] % NBUCKETS;
+	bytes = pack_pile(key, W[w], Wlen[w]);
+
+	/* In a parallel search all workers share the dictionary of the
+	master.  Looking a pile up only locks its bucket, adding one locks
+	the whole dictionary, which the master's mm allocates for. */
+
+	QMutexLocker lock( m_parallel ? &m_parallel->bucketMutex[bucket % PILELOCKS] : 0 );
+	Solver *dict = m_parallel ? m_parallel->master : this;
+
+	/* A bucket left over from an earlier generation is empty. */
+
+	head = &dict->Bucketlist[bucket];
+	if (head->gen != dict->Pilegen) {
+		head->list = NULL;
+		head->gen = dict->Pilegen;
+	}
 
 	/* Look for the pile in this bucket. */
 
 	last = NULL;
-	for (l = Bucketlist[bucket]; l; l = l->next) {
-		if (l->hash == Whash[w] &&
-		    strncmp((char*)l->pile, (char*)W[w], Wlen[w]) == 0) {
+	for (l = head->list; l; l = l->next) {
+		if (l->hash == Whash[w] && same_pile(l->pile, key, bytes)) {
 			break;
 		}
 		last = l;
@@ -563,38 +990,51 @@ int Solver::get_pilenum(int w)
 	/* If we didn't find it, make a new one and add it to the list. */
 
 	if (l == NULL) {
-		if (Pilenum >= NPILES ) {
+		QMutexLocker add( m_parallel ? &m_parallel->pileMutex : 0 );
+		pilenum = dict->Pilenum;
+		if (pilenum >= NPILES ) {
                         Status = UnableToDetermineSolvability;
 			//qDebug() << "out of piles";
 			return -1;
 		}
-		l = mm_allocate(BUCKETLIST);
+
+		/* Every PILEPAGE piles the reverse mapping needs a new page. */
+
+		if (pilenum % PILEPAGE == 0) {
+			page = (BUCKETLIST **)dict->mm->new_from_chain(&dict->Pilearena, PILEPAGE * sizeof(BUCKETLIST *));
+			if (page == NULL) {
+				Status = MemoryLimitReached;
+				return -1;
+			}
+			dict->Pilebucket[pilenum / PILEPAGE] = page;
+		}
+
+		/* The packed pile goes right behind the entry, rounded up
+		to keep the next entry aligned. */
+
+		l = (BUCKETLIST *)dict->mm->new_from_chain(&dict->Pilearena,
+		    (sizeof(BUCKETLIST) + bytes + ALIGN_BITS) & ~ALIGN_BITS);
 		if (l == NULL) {
-                        Status = UnableToDetermineSolvability;
+                        Status = MemoryLimitReached;
 			//qDebug() << "out of buckets";
 			return -1;
 		}
-		l->pile = new_array(quint8, Wlen[w] + 1);
-		if (l->pile == NULL) {
-                    Status = UnableToDetermineSolvability;
-                    MemoryManager::free_ptr(l);
-		    //qDebug() << "out of memory";
-                    return -1;
-		}
 
 		/* Store the new pile along with its hash.  Maintain
 		a reverse mapping so we can unpack the piles swiftly. */
 
-		strncpy((char*)l->pile, (char*)W[w], Wlen[w] + 1);
+		l->pile = (quint8 *)(l + 1);
+		memcpy(l->pile, key, bytes);
 		l->hash = Whash[w];
-		l->pilenum = pilenum = Pilenum++;
+		l->pilenum = pilenum;
 		l->next = NULL;
 		if (last == NULL) {
-			Bucketlist[bucket] = l;
+			head->list = l;
 		} else {
 			last->next = l;
 		}
-		Pilebucket[pilenum] = l;
+		dict->Pilebucket[pilenum / PILEPAGE][pilenum % PILEPAGE] = l;
+		dict->Pilenum++;
 	}
 
 #if 0
@@ -609,20 +1049,20 @@ if (w < 4) {
 	return l->pilenum;
 }
 
+/* Empty the pile dictionary.  Nothing but the counters is touched, the
+entries are simply left in the arena for the next search to overwrite. */
+
 void Solver::free_buckets(void)
 {
-	int i, j;
-	BUCKETLIST *l, *n;
-
-	for (i = 0; i < NBUCKETS; i++) {
-		l = Bucketlist[i];
-		while (l) {
-			n = l->next;
-			j = strlen((char*)l->pile);    /* @@@ use block? */
-                        MemoryManager::free_array(l->pile, j + 1);
-                        MemoryManager::free_ptr(l);
-			l = n;
-		}
+	mm->reset_chain(&Pilearena);
+	Pilenum = 0;
+
+	/* Only when the generations wrap around the buckets need to be
+	cleared for real. */
+
+	if (++Pilegen == 0) {
+		memset(Bucketlist, 0, NBUCKETS * sizeof(BUCKETHEAD));
+		Pilegen = 1;
 	}
 }
 
@@ -632,30 +1072,46 @@ priority to positions with more cards out, so the solution found is not
 guaranteed to be the shortest, but it'll be better than with a depth-first
 search. */
 
+void Solver::init_queues()
+{
+	int i;
+
+	for (i = 0; i < NQUEUES; ++i) {
+		Qhead[i] = NULL;
+		Qcount[i] = 0;
+	}
+	Maxq = 0;
+	Qpos = Minpos = 0;
+	Fqueue.clear();
+	Beam.clear();
+}
+
 void Solver::doit()
 {
-	int i, q;
+	int q;
 	POSITION *pos;
 	MOVE m;
         memset( &m, 0, sizeof( MOVE ) );
 
+	if (m_strategy == IDAStar) {
+		ida_doit();
+		return;
+	}
+
 	/* Init the queues. */
 
-	for (i = 0; i < NQUEUES; ++i) {
-		Qhead[i] = NULL;
-	}
-	Maxq = 0;
+	init_queues();
 
 	/* Queue the initial position to get started. */
 
 	hash_layout();
-	pilesort();
 	m.card_index = -1;
         m.turn_index = -1;
 	pos = new_position(NULL, &m);
 	if ( pos == NULL )
         {
-            Status = UnableToDetermineSolvability;
+            if ( Status == NoSolutionExists )
+                Status = UnableToDetermineSolvability;
             return;
         }
 	queue_position(pos, 0);
@@ -668,79 +1124,547 @@ void Solver::doit()
                     free_position(pos, true);
 		}
 	}
-}
 
-/* Generate all the successors to a position and either queue them or
-recursively solve them.  Return whether any of the child nodes, or their
-descendents, were queued or not (if not, the position can be freed). */
+	/* Running out of positions proves nothing if some were dropped. */
 
-bool Solver::solve(POSITION *parent)
+	if (Status == NoSolutionExists && Evicted) {
+		Status = MemoryLimitReached;
+	}
+	if (Status == NoSolutionExists && Pruned) {
+		Status = UnableToDetermineSolvability;
+	}
+}
+
+/* Iterative deepening on f.  Every iteration is a depth first search from
+the start that passes over the positions above the bound, and the next one
+raises the bound to the lowest f passed over.  Only the current line is
+kept as positions, the visited set stands for the transposition table and
+starts out empty every time, just the pile dictionary survives.  The deal
+is lost when an iteration passes over nothing.
+
+The table doesn't keep depths: a position first reached on a long line is
+passed over when a shorter one gets to it later in the same iteration, so
+the part of the bound that line would leave below it is lost.  The
+solutions can come out longer and an iteration can miss one that fits the
+bound, a later one with a higher bound finds it.  What the long line
+passes over still counts for Next_bound, so a deal found lost is lost.
+Searching such positions again costs far more than it gains, a deal of
+Klondike took twenty times the positions. */
+
+void Solver::ida_doit()
 {
-	int i, nmoves, qq;
-	MOVE *mp, *mp0;
 	POSITION *pos;
+	MOVE m;
+	memset( &m, 0, sizeof( MOVE ) );
+	m.card_index = -1;
+	m.turn_index = -1;
 
-        bool q;
-        all_moves++;
-
-	/* If we've won already (or failed), we just go through the motions
-	but always return false from any position.  This enables the cleanup
-	of the move stack and eventual destruction of the position store. */
-
-	if (Status != NoSolutionExists) {
-		return false;
-	}
+	init_queues();
+	hash_layout();
+	Bound = fvalue(0);
 
-        {
-            QMutexLocker lock( &endMutex );
-            if ( m_shouldEnd )
-            {
-                Status = SearchAborted;
-                return false;
-            }
-        }
+	forever {
+		Next_bound = INT_MAX;
+		firstMoves.clear();
 
-        if ( max_positions != -1 && Total_positions > ( unsigned long )max_positions )
-        {
-            Status = MemoryLimitReached;
-            return false;
-        }
+		pos = new_position(NULL, &m);
+		if (pos == NULL) {
+			if (Status == NoSolutionExists) {
+				Status = UnableToDetermineSolvability;
+			}
+			return;
+		}
+		solve(pos);
 
+		if (Status != NoSolutionExists || Next_bound == INT_MAX) {
+			return;
+		}
 
-	/* Generate an array of all the moves we can make. */
+		/* The work arrays are back at the start. */
 
-	if ((mp0 = get_moves(&nmoves)) == NULL) {
-            if ( isWon() ) {
-                Status = SolutionExists;
-                win( parent );
-            }
-            return false;
+		mm->free_clusters();
+		mm->free_blocks();
+		mm->init_clusters();
+		Freepos = NULL;
+		Bound = Next_bound;
 	}
+}
 
-        if ( parent->depth == 0 )
-        {
-            Q_ASSERT( firstMoves.count() == 0 );
-            for (int j = 0; j < nmoves; ++j)
-                firstMoves.append( Possible[j] );
-        }
+/* f of the layout in the work arrays, reached after depth moves, in
+hundredths of a move.  The estimate of the moves to come is the cards still
+to go out, as far as getOuts() tells.  Only differences of f matter, so it
+leaves out the number of cards and simply subtracts the ones out.  That is
+not admissible for the games that take out whole suits at once, so the
+solutions found are short, but not always the shortest. */
 
-	parent->nchild = nmoves;
+int Solver::fvalue(int depth)
+{
+	return 100 * depth - m_weight * getOuts();
+}
 
-	/* Make each move and either solve or queue the result. */
+/* Use what a retained search found out about the current layout.  If it
+ended without a solution, every position it visited is lost too: the
+layout is either one of them, or the visited set stays to cut the new
+search short.  If it was won, the layout may be on its winning line.
+Otherwise only the pile dictionary is of any use, see set_aside_search():
+the positions a won search visited were only seen, not lost, so they can't
+cut a new search short.  Barely one in a hundred of them has every move
+out of it searched to a lost end, too few to keep a table of them.  Returns
+true if the layout has been answered already. */
+
+bool Solver::reuse_search()
+{
+    if ( !Retained )
+        return false;
 
-	q = false;
-	for (i = 0, mp = mp0; i < nmoves; ++i, ++mp) {
-		make_move(mp);
+    hash_layout();
+    TREE *node = find_visited( mm, getClusterNumber() );
 
-		/* Calculate indices for the new piles. */
+    if ( Retained_status == NoSolutionExists )
+    {
+        if ( node == NULL )
+            return false;
+        Status = NoSolutionExists;
+        return true;
+    }
+
+    /* The line may have had the symmetric piles in another order. */
+    const int i = node ? Winline.indexOf( node ) : -1;
+    if ( i >= 0 )
+    {
+        winMoves = Retained_moves.mid( i );
+        const quint64 order = pile_order();
+        if ( order != Winorder[i] )
+            translate_moves( winMoves, Winorder[i], order );
+        Status = SolutionExists;
+        return true;
+    }
+
+    return false;
+}
+
+/* Make room for a search reuse_search() could not spare.  A search with a
+budget may well end without an answer, so the retained one is only set
+aside then, and patsolve() brings it back as it was.  The visited set of a
+won search is no help to the new one, which starts from an empty one.
+Otherwise, and if there is no memory for that, what was won goes. */
+
+bool Solver::set_aside_search()
+{
+    const bool dead = Retained_status == NoSolutionExists;
+    if ( max_positions > 0 && mm->save_visited( dead ) )
+        return true;
+
+    if ( !dead )
+    {
+        mm->free_clusters();
+        mm->free_blocks();
+        mm->init_clusters();
+        Freepos = NULL;
+        Winline.clear();
+        Winorder.clear();
+        Retained_moves.clear();
+    }
+    return false;
+}
+
+void Solver::forget_search()
+{
+    free();
+    Retained = false;
+    Winline.clear();
+    Winorder.clear();
+    Winindex.clear();
+    Retained_moves.clear();
+}
+
+/* The positions only have room for pile numbers of Pilewidth bytes.  When
+the dictionary outgrows that, the search is given up and done over from the
+start with one byte more for every pile.  The dictionary stays, so the
+numbers don't change, but the positions all have to be stored again. */
+
+void Solver::remember_start()
+{
+    hash_layout();
+    pilesort();
+    Start_piles.resize( m_number_piles );
+    for ( int w = 0; w < m_number_piles; ++w )
+        Start_piles[w] = Wpilenum[w];
+    Start_cluster = getClusterNumber();
+}
+
+void Solver::widen_search()
+{
+    mm->free_clusters();
+    mm->free_blocks();
+    mm->init_clusters();
+    Freepos = NULL;
+    Winline.clear();
+    Winorder.clear();
+    Winindex.clear();
+    firstMoves.clear();
+    set_pile_width( Pilewidth + 1 );
+    restore_start();
+
+    Status = NoSolutionExists;
+    Widen = false;
+    Evicted = 0;
+    Pruned = 0;
+}
+
+/* Back to the layout remember_start() saw. */
+
+void Solver::restore_start()
+{
+    unpack_cluster( Start_cluster );
+    for ( int w = 0; w < m_number_piles; ++w )
+        restore_pile( w, Start_piles[w] );
+}
+
+/* Moves made from a layout with the symmetric piles in order from, made
+from the same layout with them in order to instead. */
+
+void Solver::translate_moves( QList<MOVE> &moves, quint64 from, quint64 to )
+{
+    QVector<int> map( m_number_piles );
+    for ( int w = 0; w < m_number_piles; ++w )
+        map[w] = w;
+    for ( int w = 0; w < m_number_piles; ++w )
+    {
+        if ( Wslot[w] >= 0 )
+        {
+            const int shift = 4 * Wslot[w];
+            map[Wmix[w] + ( ( from >> shift ) & 0xF )] = Wmix[w] + ( ( to >> shift ) & 0xF );
+        }
+    }
+
+    for ( int i = 0; i < moves.count(); ++i )
+    {
+        MOVE &m = moves[i];
+        m.from = map[m.from];
+        if ( m.totype == W_Type )
+            m.to = map[m.to];
+    }
+}
+
+QVector<qreal> Solver::parameters() const
+{
+    QVector<qreal> values;
+    for ( int i = 0; i < 3; ++i )
+        values << Yparam[i];
+    return values;
+}
+
+bool Solver::setParameters( const QVector<qreal> & values )
+{
+    if ( values.size() != parameters().size() )
+        return false;
+    for ( int i = 0; i < 3; ++i )
+        Yparam[i] = values[i];
+    return true;
+}
+
+void Solver::setRetainSearch( bool retain )
+{
+    m_retainSearch = retain;
+    if ( !retain && Retained )
+        forget_search();
+}
+
+/* The same search with several threads.  The workers are clone()s of this
+solver that share the visited set, the pile dictionary and the count of
+pending positions.  A worker whose own queues run dry steals the best
+position of another one.  The search ends when nothing is pending any more
+or when a worker stops it, because it won or had to give up.  This solver
+doesn't search itself meanwhile, its mm only allocates for the pile
+dictionary.  All of them draw on its memory limit. */
+
+void Solver::parallel_doit( int threads )
+{
+    ParallelSearch search;
+    search.master = this;
+    for ( int i = 0; i < VSHARDS; ++i )
+    {
+        search.visited[i].setBackend( MemoryManager::HashBackend );
+        search.visited[i].Pilebytes = mm->Pilebytes;
+    }
+
+    /* POSITION only has a byte for the worker. */
+    for ( int i = 0; i < qMin( threads, 256 ); ++i )
+    {
+        Solver *worker = clone();
+        if ( !worker )
+            break;
+        worker->debug = debug;
+        worker->init();
+        worker->set_pile_width( Pilewidth );
+        worker->init_queues();
+        worker->hash_layout();
+
+        delete [] worker->Bucketlist;
+        delete [] worker->Pilebucket;
+        worker->Bucketlist = Bucketlist;
+        worker->Pilebucket = Pilebucket;
+        worker->m_parallel = &search;
+        worker->m_worker = search.participants.count();
+        search.participants << worker;
+    }
+
+    if ( search.participants.count() < 2 )
+    {
+        foreach ( Solver *worker, search.participants )
+        {
+            worker->Bucketlist = 0;
+            worker->Pilebucket = 0;
+            worker->mm->free_clusters();
+            worker->mm->free_blocks();
+            delete worker;
+        }
+        doit();
+        return;
+    }
+
+    const size_t limit = mm->Mem_limit;
+    search.budget.limit = limit;
+    mm->share( &search.budget );
+    for ( int i = 0; i < VSHARDS; ++i )
+        search.visited[i].share( &search.budget );
+    foreach ( Solver *worker, search.participants )
+        worker->mm->share( &search.budget );
+
+    const int total_positions = max_positions;
+    foreach ( Solver *worker, search.participants )
+        worker->max_positions = total_positions == -1 ? -1 : total_positions / search.participants.count();
+
+    Solver *first = search.participants.first();
+    MOVE m;
+    memset( &m, 0, sizeof( MOVE ) );
+    m.card_index = -1;
+    m.turn_index = -1;
+    POSITION *pos = first->new_position( NULL, &m );
+    if ( pos == NULL )
+    {
+        Status = first->Status == NoSolutionExists ? UnableToDetermineSolvability : first->Status;
+    }
+    else
+    {
+        first->queue_position( pos, 0 );
+
+        QList<SearchWorker*> workers;
+        for ( int i = 1; i < search.participants.count(); ++i )
+        {
+            workers << new SearchWorker( search.participants[i] );
+            workers.last()->start();
+        }
+        first->work();
+        foreach ( SearchWorker *worker, workers )
+            worker->wait();
+        qDeleteAll( workers );
+    }
+
+    /* Publish the first win, otherwise the first reason to give up. */
+
+    Solver *winner = search.winner.load();
+    if ( winner )
+    {
+        Status = SolutionExists;
+        winMoves = winner->winMoves;
+    }
+
+    size_t peak = mm->Mem_peak;
+    for ( int i = 0; i < VSHARDS; ++i )
+    {
+        peak += search.visited[i].Mem_peak;
+        search.visited[i].free_clusters();
+    }
+    foreach ( Solver *worker, search.participants )
+    {
+        if ( Status == NoSolutionExists )
+            Status = worker->Status;
+        if ( firstMoves.isEmpty() )
+            firstMoves = worker->firstMoves;
+        Widen |= worker->Widen;
+        Total_positions += worker->Total_positions;
+        Total_generated += worker->Total_generated;
+        Dead_ends += worker->Dead_ends;
+        Evicted += worker->Evicted;
+        all_moves += worker->all_moves;
+        peak += worker->mm->Mem_peak;
+        Clusters.unite( worker->Clusters );
+        Maxdepth = qMax( Maxdepth, worker->Maxdepth );
+
+        /* The dictionary is ours, free() takes care of it. */
+        worker->Bucketlist = 0;
+        worker->Pilebucket = 0;
+        worker->mm->free_clusters();
+        worker->mm->free_blocks();
+        delete worker;
+    }
+
+    /* Running out of positions proves nothing if some were dropped. */
+
+    if ( Status == NoSolutionExists && Evicted )
+        Status = MemoryLimitReached;
+
+    Winline.clear();
+    Winorder.clear();
+    mm->share( 0, limit );
+    mm->Mem_peak = peak;
+    max_positions = total_positions;
+}
+
+/* The loop of one worker in a parallel search. */
+
+void Solver::work()
+{
+    POSITION *pos;
+    Solver *master = m_parallel->master;
+    int n = 0;
+
+    while ( !m_parallel->stop.load() )
+    {
+        /* The master doesn't search, so its abort is looked at here, now
+           and then. */
+        if ( ( ++n & 255 ) == 0 )
+        {
+            QMutexLocker lock( &master->endMutex );
+            if ( master->m_shouldEnd )
+            {
+                Status = SearchAborted;
+                m_parallel->stop.store( 1 );
+                break;
+            }
+        }
+
+        pos = dequeue_position();
+        if ( pos == NULL )
+            pos = steal_position();
+        if ( pos == NULL )
+        {
+            if ( m_parallel->pending.load() == 0 )
+                break;
+            QThread::yieldCurrentThread();
+            continue;
+        }
 
-		pilesort();
+        if ( !solve( pos ) )
+            free_position( pos, true );
+        m_parallel->pending.deref();
+
+        if ( Status != NoSolutionExists )
+        {
+            if ( Status == SolutionExists )
+                m_parallel->winner.testAndSetOrdered( 0, this );
+            m_parallel->stop.store( 1 );
+        }
+    }
+}
+
+/* Take the best position from another worker and unpack it. */
+
+POSITION *Solver::steal_position()
+{
+    const QList<Solver*> &all = m_parallel->participants;
+
+    for ( int i = 1; i < all.count(); ++i )
+    {
+        POSITION *pos = all[( m_worker + i ) % all.count()]->take_position();
+        if ( pos )
+        {
+            unpack_position( pos );
+            return pos;
+        }
+    }
+    return NULL;
+}
+
+/* Generate all the successors to a position and either queue them or
+recursively solve them.  Return whether any of the child nodes, or their
+descendents, were queued or not (if not, the position can be freed). */
+
+bool Solver::solve(POSITION *parent)
+{
+	int i, nmoves, qq;
+	MOVE *mp, *mp0;
+	POSITION *pos;
+
+        all_moves++;
+
+	/* If we've won already (or failed), we just go through the motions
+	but always return false from any position.  This enables the cleanup
+	of the move stack and eventual destruction of the position store. */
+
+	if (Status != NoSolutionExists) {
+		return false;
+	}
+
+        if ( m_parallel && m_parallel->stop.load() )
+            return false;
+
+        {
+            QMutexLocker lock( &endMutex );
+            if ( m_shouldEnd )
+            {
+                Status = SearchAborted;
+                return false;
+            }
+        }
+
+        if ( max_positions != -1 && Total_positions > ( unsigned long )max_positions )
+        {
+            Status = MemoryLimitReached;
+            return false;
+        }
+
+
+	/* Generate an array of all the moves we can make. */
+
+	if ((mp0 = get_moves(&nmoves)) == NULL) {
+            if ( nmoves < 0 ) {
+                Status = MemoryLimitReached;
+            } else if ( isWon() ) {
+                Status = SolutionExists;
+                win( parent );
+            }
+            return false;
+	}
+
+        if ( parent->depth == 0 )
+        {
+            Q_ASSERT( firstMoves.count() == 0 );
+            for (int j = 0; j < nmoves; ++j)
+                firstMoves.append( Possible[j] );
+        }
+
+	/* The moves still to be made count as a child, so the children
+	other workers take over in a parallel search can't free the parent
+	before that. */
+
+	parent->nchild.store(nmoves + 1);
+
+	/* Make each move and either solve or queue the result. */
+
+	for (i = 0, mp = mp0; i < nmoves; ++i, ++mp) {
+		make_move(mp);
+
+		/* IDAStar passes over what is beyond the bound, without
+		storing it: it may be reached on a shorter line later on. */
+
+		if (m_strategy == IDAStar) {
+			int f = fvalue(parent->depth + 1);
+			if (f > Bound) {
+				Next_bound = qMin(Next_bound, f);
+				undo_move(mp);
+				parent->nchild.deref();
+				continue;
+			}
+		}
 
 		/* See if this is a new position. */
 
 		if ((pos = new_position(parent, mp)) == NULL) {
 			undo_move(mp);
-			parent->nchild--;
+			parent->nchild.deref();
 			continue;
 		}
 
@@ -748,25 +1672,131 @@ bool Solver::solve(POSITION *parent)
 		Don't queue it, just keep going.  A larger cutoff can also
 		force a recursive call, which can help speed things up (but
 		reduces the quality of solutions).  Otherwise, save it for
-		later. */
+		later.  The strategies ranking by f queue everything, but
+		IDAStar, which doesn't queue at all. */
 
-		if (pos->cluster != parent->cluster || !nmoves) {
+		if (m_strategy == IDAStar || (m_strategy == BestFirst &&
+		    (pos->cluster != parent->cluster || !nmoves))) {
 			qq = solve(pos);
 			undo_move(mp);
 			if (!qq) {
 				free_position(pos, false);
 			}
-			q |= (bool)qq;
 		} else {
 			queue_position(pos, mp->pri);
 			undo_move(mp);
-			q = true;
 		}
 	}
-        MemoryManager::free_array(mp0, nmoves);
+        mm->free_array(mp0, nmoves);
+
+	/* Return true if this position needs to be kept around, because
+	some of its children still are. */
+	return parent->nchild.deref();
+}
+
+/* Whether a face down card in the piles first to first + count - 1 can never
+move again, which loses the game.  For tableaus that build down, in suit or
+in alternating colours, where face up cards move with the ones on top of
+them, only kings go into empty piles and nothing comes back from the
+foundations.  out[] has the rank on the foundation of every suit.
+
+Once turned, a card goes out after all the lower cards of its suit, or onto
+one of the cards a rank higher that take it.  All face down cards but the
+kings start out frozen, and the ones that might still go either way thaw,
+until the frozen ones block each other: a lower card of their suit is
+frozen or lies under a frozen card, and every card they could go onto is
+out already or lies under a frozen card.  None of them can be the first
+one to move then. */
+
+static quint64 card_bits(const card_t *w, int len)
+{
+	quint64 bits = 0;
+
+	while (len-- > 0) {
+		bits |= (quint64)1 << (w[len] & 0x3F);
+	}
+	return bits;
+}
+
+bool Solver::frozen_cards(int first, int count, const card_t *out, bool inSuit)
+{
+	int w, i, j, n, c, r, s, t, left;
+	int top[16], cw[64], ci[64];
+	quint64 below, covered, under;
+	bool stuck, thawed;
+
+	/* The face down cards are the bottom ones of every pile. */
+
+	Q_ASSERT(count <= 16);
+	n = 0;
+	for (w = 0; w < count; w++) {
+		top[w] = -1;
+		for (i = 0; i < Wlen[first + w] && DOWN(W[first + w][i]); i++) {
+			if (RANK(W[first + w][i]) != PS_KING) {
+				cw[n] = w;
+				ci[n++] = i;
+				top[w] = i;
+			}
+		}
+	}
+
+	left = n;
+	while (left) {
 
-	/* Return true if this position needs to be kept around. */
-	return q;
+		/* The cards that are frozen or under a frozen card, and the
+		ones under a frozen card. */
+
+		below = covered = 0;
+		for (w = 0; w < count; w++) {
+			if (top[w] >= 0) {
+				under = card_bits(W[first + w], top[w]);
+				covered |= under;
+				below |= under | card_bits(&W[first + w][top[w]], 1);
+			}
+		}
+
+		thawed = false;
+		for (j = 0; j < n; j++) {
+			if (ci[j] < 0) {
+				continue;
+			}
+			c = W[first + cw[j]][ci[j]] & 0x3F;
+			s = c >> 4;
+			r = c & 0xF;
+			stuck = (below >> (s << 4)) & (((quint64)1 << r) - 2);
+			for (t = 0; t < 4 && stuck; t++) {
+				if (inSuit ? t != s : (t & 1) == (s & 1)) {
+					continue;
+				}
+				if (out[t] <= r &&
+				    !(covered & ((quint64)1 << ((t << 4) + r + 1)))) {
+					stuck = false;
+				}
+			}
+			if (stuck) {
+				continue;
+			}
+
+			/* Thaw it.  The masks only shrink with that, so the
+			next round sees if it frees any others. */
+
+			ci[j] = -1;
+			thawed = true;
+			left--;
+			w = cw[j];
+			top[w] = -1;
+			for (i = 0; i < n; i++) {
+				if (cw[i] == w && ci[i] > top[w]) {
+					top[w] = ci[i];
+				}
+			}
+		}
+		if (!thawed) {
+			break;
+		}
+	}
+
+	return left > 0;
 }
 
 /* We can't free the stored piles in the trees, but we can free some of the
@@ -774,28 +1804,78 @@ POSITION structs.  We have to be careful, though, because there are many
 threads running through the game tree starting from the queued positions.
 The nchild element keeps track of descendents, and when there are none left
 in the parent we can free it too after solve() returns and we get called
-recursively (rec == true). */
+recursively (rec == true).  In a parallel search the children of a position
+may be solved by other workers than its own, so nchild is atomic and every
+position goes back to the worker that allocated it. */
 
 void Solver::free_position(POSITION *pos, int rec)
 {
-    /* We don't really free anything here, we just push it onto a
-       freelist (using the queue member), so we can use it again later. */
+    POSITION *parent, *head;
+    Solver *owner;
 
-    if (!rec) {
-        pos->queue = Freepos;
-        Freepos = pos;
-        pos->parent->nchild--;
-    } else {
-        do {
+    /* We don't really free anything here, we just push it onto a
+       freelist (using the queue member), so we can use it again later.
+       Once it is on the freelist of another worker it may be reused
+       right away, so the parent has to be read first. */
+
+    do {
+        parent = pos->parent;
+        if (m_parallel && pos->owner != m_worker) {
+            owner = m_parallel->participants[pos->owner];
+            do {
+                head = owner->Returned.load();
+                pos->queue = head;
+            } while (!owner->Returned.testAndSetRelease(head, pos));
+        } else {
             pos->queue = Freepos;
             Freepos = pos;
-            pos = pos->parent;
-            if (pos == NULL) {
-                return;
-            }
-            pos->nchild--;
-        } while (pos->nchild == 0);
-    }
+        }
+        pos = parent;
+        if (pos == NULL) {
+            return;
+        }
+    } while (!pos->nchild.deref() && rec);
+}
+
+/* Make room when memory runs short: drop a batch of queued positions of
+the lowest priorities onto the freelist.  The search goes on with the
+better ones, but as the dropped positions stay in the visited set it can
+no longer prove a deal lost.  Only the POSITION structs are reused, the
+visited set and the pile dictionary go on growing, so this just puts off
+the end: once they fill the budget the search stops as MemoryLimitReached. */
+
+#define EVICT_BATCH 1024
+
+void Solver::evict_positions()
+{
+	int q, n;
+	POSITION *pos;
+
+	QMutexLocker lock( m_parallel ? &Qmutex : 0 );
+	n = 0;
+	while (!Fqueue.isEmpty() && n < EVICT_BATCH) {
+		QMap<int,POSITION*>::iterator it = Fqueue.end() - 1;
+		pos = it.value();
+		if (pos->queue) {
+			it.value() = pos->queue;
+		} else {
+			Fqueue.erase(it);
+		}
+		free_position(pos, true);
+		n++;
+	}
+	for (q = 0; q < Maxq && n < EVICT_BATCH; ++q) {
+		while ((pos = Qhead[q]) != NULL && n < EVICT_BATCH) {
+			Qhead[q] = pos->queue;
+			Qcount[q]--;
+			free_position(pos, true);
+			n++;
+		}
+	}
+	Evicted += n;
+	if (m_parallel) {
+		m_parallel->pending.fetchAndAddOrdered(-n);
+	}
 }
 
 /* Save positions for consideration later.  pri is the priority of the move
@@ -808,9 +1888,15 @@ void Solver::queue_position(POSITION *pos, int pri)
 	additional priority depending on the number of cards out.  We use a
 	"queue squashing function" to map nout to priority.  */
 
+	if (m_strategy != BestFirst) {
+		POSITION *&head = Fqueue[fvalue(pos->depth)];
+		pos->queue = head;
+		head = pos;
+		return;
+	}
+
         int nout = getOuts();
 
-        static qreal Yparam[] = { 0.0032, 0.32, -3.0 };
 	qreal x = (Yparam[0] * nout + Yparam[1]) * nout + Yparam[2];
 	pri += (int)floor(x + .5);
 
@@ -819,14 +1905,16 @@ void Solver::queue_position(POSITION *pos, int pri)
 	} else if (pri >= NQUEUES) {
 		pri = NQUEUES - 1;
 	}
-	if (pri > Maxq) {
-		Maxq = pri;
-	}
 
 	/* We always dequeue from the head.  Here we either stick the move
 	at the head or tail of the queue, depending on whether we're
 	pretending it's a stack or a queue. */
 
+	QMutexLocker lock( m_parallel ? &Qmutex : 0 );
+	if (pri > Maxq) {
+		Maxq = pri;
+	}
+
 	pos->queue = NULL;
 	if (Qhead[pri] == NULL) {
 		Qhead[pri] = pos;
@@ -834,6 +1922,10 @@ void Solver::queue_position(POSITION *pos, int pri)
             pos->queue = Qhead[pri];
             Qhead[pri] = pos;
 	}
+	Qcount[pri]++;
+	if (m_parallel) {
+		m_parallel->pending.ref();
+	}
 }
 
 /* Return the position on the head of the queue, or NULL if there isn't one. */
@@ -842,8 +1934,6 @@ POSITION *Solver::dequeue_position()
 {
 	int last;
 	POSITION *pos;
-	static int qpos = 0;
-	static int minpos = 0;
 
 	/* This is a kind of prioritized round robin.  We make sweeps
 	through the queues, starting at the highest priority and
@@ -852,36 +1942,65 @@ POSITION *Solver::dequeue_position()
 	but we still get lots of low priority action (instead of
 	ignoring it completely). */
 
+	if (m_strategy != BestFirst) {
+		if (m_strategy == BeamSearch) {
+			if (Beam.isEmpty()) {
+				next_beam();
+			}
+			if (Beam.isEmpty()) {
+				return NULL;
+			}
+			pos = Beam.takeFirst();
+		} else {
+			if (Fqueue.isEmpty()) {
+				return NULL;
+			}
+			QMap<int,POSITION*>::iterator it = Fqueue.begin();
+			pos = it.value();
+			if (pos->queue) {
+				it.value() = pos->queue;
+			} else {
+				Fqueue.erase(it);
+			}
+		}
+		unpack_position(pos);
+		return pos;
+	}
+
+	QMutexLocker lock( m_parallel ? &Qmutex : 0 );
+
 	last = false;
 	do {
-		qpos--;
-		if (qpos < minpos) {
+		Qpos--;
+		if (Qpos < Minpos) {
 			if (last) {
 				return NULL;
 			}
-			qpos = Maxq;
-			minpos--;
-			if (minpos < 0) {
-				minpos = Maxq;
+			Qpos = Maxq;
+			Minpos--;
+			if (Minpos < 0) {
+				Minpos = Maxq;
 			}
-			if (minpos == 0) {
+			if (Minpos == 0) {
 				last = true;
 			}
 		}
-	} while (Qhead[qpos] == NULL);
+	} while (Qhead[Qpos] == NULL);
 
-	pos = Qhead[qpos];
-	Qhead[qpos] = pos->queue;
+	pos = Qhead[Qpos];
+	Qhead[Qpos] = pos->queue;
+	Qcount[Qpos]--;
 
 	/* Decrease Maxq if that queue emptied. */
 
-	while (Qhead[qpos] == NULL && qpos == Maxq && Maxq > 0) {
+	while (Qhead[Qpos] == NULL && Qpos == Maxq && Maxq > 0) {
 		Maxq--;
-		qpos--;
-		if (qpos < minpos) {
-			minpos = qpos;
+		Qpos--;
+		if (Qpos < Minpos) {
+			Minpos = Qpos;
 		}
 	}
+	lock.unlock();
 
 	/* Unpack the position into the work arrays. */
 
@@ -890,9 +2009,98 @@ POSITION *Solver::dequeue_position()
 	return pos;
 }
 
+/* The current depth of BeamSearch is done, go on with the best positions
+of the next one and drop the others. */
+
+void Solver::next_beam()
+{
+	POSITION *pos, *next;
+	QMap<int,POSITION*>::const_iterator it;
+
+	for (it = Fqueue.constBegin(); it != Fqueue.constEnd(); ++it) {
+		for (pos = it.value(); pos; pos = next) {
+			next = pos->queue;
+			if (Beam.count() < m_beamWidth) {
+				Beam.append(pos);
+			} else {
+				free_position(pos, true);
+				Pruned++;
+			}
+		}
+	}
+	Fqueue.clear();
+}
+
+/* Take the best position off the queue without unpacking it.  This is how
+other workers steal from this one in a parallel search. */
+
+POSITION *Solver::take_position()
+{
+	int q;
+	POSITION *pos;
+
+	QMutexLocker lock( &Qmutex );
+
+	for (q = Maxq; q >= 0 && Qhead[q] == NULL; q--)
+		;
+	if (q < 0) {
+		return NULL;
+	}
+	pos = Qhead[q];
+	Qhead[q] = pos->queue;
+	Qcount[q]--;
+	while (Qhead[Maxq] == NULL && Maxq > 0) {
+		Maxq--;
+	}
+	return pos;
+}
+
 Solver::Solver()
+{
+    create();
+}
+
+/* Copies the layout and the setup, but none of the search state. */
+
+Solver::Solver( const Solver &other )
+{
+    create();
+    mm->setBackend( other.mm->backend() );
+    mm->Mem_limit = other.mm->Mem_limit;
+    m_newer_piles_first = other.m_newer_piles_first;
+    m_improveMsecs = other.m_improveMsecs;
+    m_strategy = other.m_strategy;
+    m_weight = other.m_weight;
+    m_beamWidth = other.m_beamWidth;
+    memcpy( Yparam, other.Yparam, sizeof( Yparam ) );
+
+    setNumberPiles( other.m_number_piles );
+    for ( int g = 0; g < other.Nsym; ++g )
+        addSymmetricPiles( other.Symfirst[g], other.Symcount[g] );
+    for ( int w = 0; w < m_number_piles; ++w )
+    {
+        memcpy( W[w], other.W[w], PILESIZE );
+        Wlen[w] = other.Wlen[w];
+        Wp[w] = &W[w][Wlen[w] - 1];
+    }
+}
+
+void Solver::create()
 {
     mm = new MemoryManager();
+    m_parallel = 0;
+    m_worker = 0;
+    m_retainSearch = false;
+    m_improveMsecs = 0;
+    Nsym = 0;
+    m_strategy = BestFirst;
+    m_weight = 200;
+    m_beamWidth = 1000;
+    Yparam[0] = 0.0032;
+    Yparam[1] = 0.32;
+    Yparam[2] = -3.0;
+    Retained = false;
+    Retained_status = NoSolutionExists;
     Freepos = NULL;
     m_newer_piles_first = true;
     /* Work arrays. */
@@ -903,12 +2111,32 @@ Solver::Solver()
 
     Whash = 0;
     Wpilenum = 0;
+    Wmix = 0;
+    Wslot = 0;
+    Poshash = 0;
     Stack = 0;
+    all_moves = 0;
+
+    Bucketlist = new BUCKETHEAD[NBUCKETS];
+    memset( Bucketlist, 0, NBUCKETS * sizeof( BUCKETHEAD ) );
+    Pilebucket = new BUCKETLIST**[NPILES / PILEPAGE];
+    Pilearena = 0;
+    Pilegen = 1;
+    Pilenum = 0;
+    Pilewidth = 2;
+    Widen = false;
+    Start_cluster = 0;
+    Treebytes = Posbytes = 0;
 }
 
 Solver::~Solver()
 {
+    if ( Retained )
+        free();
+    mm->free_chain( &Pilearena );
     delete mm;
+    delete [] Bucketlist;
+    delete [] Pilebucket;
 
     for ( int i = 0; i < m_number_piles; ++i )
     {
@@ -920,13 +2148,18 @@ Solver::~Solver()
     delete [] Wlen;
     delete [] Whash;
     delete [] Wpilenum;
+    delete [] Wmix;
+    delete [] Wslot;
 }
 
 void Solver::init()
 {
     m_shouldEnd = false;
-    init_buckets();
-    mm->init_clusters();
+    if ( !Retained )
+    {
+        init_buckets();
+        mm->init_clusters();
+    }
 
     winMoves.clear();
     firstMoves.clear();
@@ -934,9 +2167,18 @@ void Solver::init()
     /* Reset stats. */
 
     Status = NoSolutionExists;
+    Widen = false;
     Total_positions = 0;
     Total_generated = 0;
+    Evicted = 0;
+    Dead_ends = 0;
+    Pruned = 0;
     depth_sum = 0;
+    Clusters.clear();
+    Maxdepth = 0;
+
+    QMutexLocker lock( &statsMutex );
+    m_stats = SolverStats();
 }
 
 void Solver::free()
@@ -948,31 +2190,171 @@ void Solver::free()
 }
 
 
-Solver::ExitStatus Solver::patsolve( int _max_positions, bool _debug )
+Solver::ExitStatus Solver::patsolve( int _max_positions, bool _debug, int threads )
 {
     max_positions = _max_positions;
     debug = _debug;
 
+    /* Only a sequential search in the hash backend can be kept. */
+    const bool retain = m_retainSearch && threads <= 1
+                        && mm->backend() == MemoryManager::HashBackend;
+    if ( Retained && !retain )
+        forget_search();
+    mm->Mem_peak = mm->Mem_used;
+
+    QElapsedTimer phase;
+    phase.start();
+
     /* Initialize the suitable() macro variables. */
     init();
 
-    /* Go to it. */
-    doit();
+    /* Go to it.  A deal that is lost as it is needs no search. */
+    bool answered = reuse_search();
+    if ( !answered && isDeadEnd( 0 ) )
+    {
+        Dead_ends++;
+        Status = NoSolutionExists;
+        answered = true;
+    }
+    const bool setAside = !answered && Retained && set_aside_search();
+    const qint64 setupMsecs = phase.restart();
+    if ( answered )
+    {
+        /* Without a search the first moves are still needed for hints. */
+        int nmoves;
+        MOVE *mp0 = get_moves( &nmoves );
+        if ( mp0 )
+        {
+            for ( int j = 0; j < nmoves; ++j )
+                firstMoves.append( Possible[j] );
+            mm->free_array( mp0, nmoves );
+        }
+    }
+    else if ( !own_search() )
+    {
+        remember_start();
+        forever
+        {
+            if ( threads > 1 && m_strategy == BestFirst
+                 && mm->backend() == MemoryManager::HashBackend )
+                parallel_doit( threads );
+            else
+                doit();
+
+            /* Run out of pile numbers?  Start over with wider ones. */
+            if ( !Widen || Status == SolutionExists || Status == SearchAborted )
+                break;
+            widen_search();
+        }
+
+        /* The workers of a parallel search took their lines with them. */
+        if ( Status == SolutionExists && m_improveMsecs > 0 && !Winline.isEmpty() )
+            improve_solution();
+    }
 
     if ( Status == SearchAborted ) // thread quit
     {
         firstMoves.clear();
         winMoves.clear();
     }
-#if 0
-    printf("%ld positions generated (%f).\n", Total_generated, depth_sum / Total_positions);
-    printf("%ld unique positions.\n", Total_positions);
-    printf("Mem_remain = %ld\n", ( long int )mm->Mem_remain);
-#endif
-    free();
+
+    publish_stats();
+    {
+        QMutexLocker lock( &statsMutex );
+        m_stats.setupMsecs = setupMsecs;
+        m_stats.searchMsecs = phase.restart();
+    }
+
+    /* The scene makes the expanded moves, so a retained line has to
+       go through the layouts between them as well. */
+    if ( Status == SolutionExists )
+    {
+        const int count = winMoves.count();
+        expand_moves( winMoves );
+        if ( retain && !answered && winMoves.count() != count )
+            retrace_line();
+    }
+
+    /* Keep the search while it takes at most half of the memory and
+       leaves room in the pile dictionary.  One that came to no end goes
+       back to the one set aside, only its new piles stay. */
+    const bool decided = Status == SolutionExists || Status == NoSolutionExists;
+    if ( setAside && decided )
+    {
+        mm->drop_saved();
+        if ( Status == NoSolutionExists )
+        {
+            Winline.clear();
+            Winorder.clear();
+        }
+    }
+    if ( retain && decided
+         && mm->Mem_used < mm->Mem_limit / 2 && Pilenum < NPILES / 2 )
+    {
+        Retained = true;
+        Retained_status = Status;
+        if ( !answered )
+            Retained_moves = winMoves;
+    }
+    else if ( setAside && !decided && Pilenum < NPILES / 2 && mm->restore_visited() )
+    {
+        Freepos = NULL;
+    }
+    else
+    {
+        forget_search();
+    }
+
+    QMutexLocker lock( &statsMutex );
+    m_stats.cleanupMsecs = phase.elapsed();
     return Status;
 }
 
+SolverStats::SolverStats()
+  : generated( 0 ),
+    positions( 0 ),
+    clusters( 0 ),
+    maxDepth( 0 ),
+    piles( 0 ),
+    deadEnds( 0 ),
+    memoryUsed( 0 ),
+    memoryPeak( 0 ),
+    setupMsecs( 0 ),
+    searchMsecs( 0 ),
+    cleanupMsecs( 0 )
+{
+}
+
+SolverStats Solver::stats() const
+{
+    QMutexLocker lock( &statsMutex );
+    return m_stats;
+}
+
+/* Copy the counters where stats() can get at them.  Only the searching
+   thread calls this, so reading them here needs no lock. */
+
+void Solver::publish_stats()
+{
+    QMutexLocker lock( &statsMutex );
+    m_stats.generated = Total_generated;
+    m_stats.positions = Total_positions;
+    m_stats.clusters = Clusters.count();
+    m_stats.maxDepth = Maxdepth;
+    if ( m_parallel ) {
+        QMutexLocker add( &m_parallel->pileMutex );
+        m_stats.piles = m_parallel->master->Pilenum;
+    } else {
+        m_stats.piles = Pilenum;
+    }
+    m_stats.deadEnds = Dead_ends;
+    m_stats.memoryUsed = mm->Mem_used;
+    m_stats.memoryPeak = mm->Mem_peak;
+    m_stats.queued.clear();
+    for ( int q = 0; q <= Maxq; ++q )
+        m_stats.queued.append( Qcount[q] );
+}
+
 void Solver::print_layout()
 {
 }
@@ -985,8 +2367,8 @@ void Solver::setNumberPiles( int p )
     W = new card_t*[m_number_piles];
     for ( int i = 0; i < m_number_piles; ++i )
     {
-        W[i] = new card_t[84];
-        memset( W[i], 0, sizeof( card_t ) * 84 );
+        W[i] = new card_t[PILESIZE];
+        memset( W[i], 0, sizeof( card_t ) * PILESIZE );
     }
     Wp = new card_t*[m_number_piles];
 
@@ -995,6 +2377,31 @@ void Solver::setNumberPiles( int p )
     Whash = new quint32[m_number_piles];
     Wpilenum = new int[m_number_piles];
     memset( Wpilenum, 0, sizeof( int ) * m_number_piles );
+
+    Wmix = new int[m_number_piles];
+    Wslot = new int[m_number_piles];
+    for ( int i = 0; i < m_number_piles; ++i )
+    {
+        Wmix[i] = i;
+        Wslot[i] = -1;
+    }
+}
+
+void Solver::addSymmetricPiles( int first, int count )
+{
+    int slots = 0;
+    for ( int g = 0; g < Nsym; ++g )
+        slots += Symcount[g];
+    Q_ASSERT( slots + count <= MAXSYM && first + count <= m_number_piles );
+
+    Symfirst[Nsym] = first;
+    Symcount[Nsym] = count;
+    Nsym++;
+    for ( int i = 0; i < count; ++i )
+    {
+        Wmix[first + i] = first;
+        Wslot[first + i] = slots + i;
+    }
 }
 
 int Solver::translateSuit( int s )
@@ -1007,6 +2414,7 @@ int Solver::translateSuit( int s )
     return suit;
 }
 
+#ifndef PATSOLVE_HEADLESS
 int Solver::translate_pile(const KCardPile *pile, card_t *w, int size)
 {
     Q_UNUSED( size );
@@ -1026,8 +2434,155 @@ int Solver::translate_pile(const KCardPile *pile, card_t *w, int size)
 	return pile->count();
 }
 
-/* Insert key into the tree unless it's already there.  Return true if
-it was new. */
+/* The card m picks up from pile, or NULL if the pile has no such card, as
+when m comes from a solution file that doesn't fit the game, see
+DealerScene::replaySolutions(). */
+
+KCard *Solver::moved_card(const KCardPile *pile, const MOVE &m)
+{
+	if (m.card_index < 0 || m.card_index >= pile->count()) {
+		return NULL;
+	}
+	return pile->at(pile->count() - m.card_index - 1);
+}
+#endif
+
+/* Empty all piles, ready for deal_card(). */
+
+void Solver::clear_layout()
+{
+    for ( int w = 0; w < m_number_piles; ++w )
+    {
+        Wlen[w] = 0;
+        Wp[w] = &W[w][-1];
+    }
+}
+
+/* Put a card on top of a pile, the headless counterpart of addCardForDeal(). */
+
+void Solver::deal_card( int w, card_t card, bool faceUp )
+{
+    if ( !faceUp )
+        card += 1 << 7;
+    Wp[w]++;
+    *Wp[w] = card;
+    Wlen[w]++;
+}
+
+DealDeck::DealDeck( int dealNumber, int copies, const card_t *suits )
+{
+    static const card_t standardSuits[4] = { PS_CLUB, PS_DIAMOND, PS_HEART, PS_SPADE };
+    if ( !suits )
+        suits = standardSuits;
+
+    Q_ASSERT( copies >= 1 && copies <= 2 );
+
+    // DealerScene::startNew() does the same.
+    dealNumber = qMax( 1, dealNumber );
+
+    // Same order as DealerScene::setDeckContents(): by rank, then by suit.
+    m_first = m_last = 0;
+    for ( int i = 0; i < copies; ++i )
+        for ( int rank = PS_ACE; rank <= PS_KING; ++rank )
+            for ( int s = 0; s < 4; ++s )
+                m_cards[m_last++] = suits[s] + rank;
+
+    // The Windows Freecell generator, exactly like shuffled() in dealer.cpp.
+    quint32 seed = dealNumber;
+    for ( int i = m_last; i > 1; --i )
+    {
+        seed = 214013 * seed + 2531011;
+        int rand = ( seed >> 16 ) & 0x7fff;
+
+        card_t t = m_cards[i - 1];
+        m_cards[i - 1] = m_cards[rand % i];
+        m_cards[rand % i] = t;
+    }
+}
+
+/* Check whether the work arrays hold the layout stored in key.  Piles that
+have no id yet are compared by content, and get their id if they match. */
+
+bool Solver::layout_matches(quint8 *key)
+{
+	int v, w, id, first, bytes;
+	int ids[MAXSYM];
+	bool sym;
+	BUCKETLIST *l;
+	quint8 pile[PACKED_MAX];
+	quint8 *p;
+
+	sym = Nsym && pilesInterchangeable();
+	for (w = 0, p = key; w < m_number_piles; w++, p += Pilewidth) {
+		if (sym && Wslot[w] >= 0) {
+			continue;
+		}
+		id = get_pile_id(p, Pilewidth);
+		if (Wpilenum[w] >= 0) {
+			if (Wpilenum[w] != id) {
+				return false;
+			}
+			continue;
+		}
+		l = PILE_ENTRY(id);
+		if (l->hash != Whash[w] ||
+		    !same_pile(l->pile, pile, pack_pile(pile, W[w], Wlen[w]))) {
+			return false;
+		}
+		Wpilenum[w] = id;
+	}
+	if (!sym) {
+		return true;
+	}
+
+	/* A symmetric pile may be any one of its group in the key.  Once
+	they all have their numbers, sorted they must be the ones there. */
+
+	for (w = 0; w < m_number_piles; w++) {
+		if (Wslot[w] < 0 || Wpilenum[w] >= 0) {
+			continue;
+		}
+		bytes = pack_pile(pile, W[w], Wlen[w]);
+		first = Wmix[w];
+		for (v = first; v < m_number_piles && Wslot[v] >= 0 && Wmix[v] == first; v++) {
+			id = get_pile_id(key + v * Pilewidth, Pilewidth);
+			l = PILE_ENTRY(id);
+			if (l->hash == Whash[w] && same_pile(l->pile, pile, bytes)) {
+				Wpilenum[w] = id;
+				break;
+			}
+		}
+		if (Wpilenum[w] < 0) {
+			return false;
+		}
+	}
+
+	sort_symmetric(ids);
+	for (w = 0, p = key; w < m_number_piles; w++, p += Pilewidth) {
+		if (Wslot[w] >= 0 && ids[Wslot[w]] != get_pile_id(p, Pilewidth)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Find the current layout in a visited set (with the hash backend). */
+
+TREE *Solver::find_visited(MemoryManager *visited, unsigned int cluster)
+{
+	size_t probe = 0;
+	TREE *t;
+
+	while ((t = visited->next_visited(Poshash, cluster, &probe)) != NULL) {
+		if (layout_matches(visited->node_key(t))) {
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/* Insert key into the visited set unless it's already there.  Return
+NEW if it was new. */
 
 MemoryManager::inscode Solver::insert(unsigned int *cluster, int d, TREE **node)
 {
@@ -1035,13 +2590,25 @@ MemoryManager::inscode Solver::insert(unsigned int *cluster, int d, TREE **node)
 
         unsigned int k = getClusterNumber();
         *cluster = k;
+        Total_generated++;
 
-        /* Get the tree for this cluster. */
+	/* The position hash is kept up to date by hashpile(), so known
+	positions can be found before the new piles are given ids. */
+
+        MemoryManager *visited = m_parallel ? &m_parallel->visited[VSHARD(Poshash)] : mm;
+        QMutex *visitedMutex = m_parallel ? &m_parallel->visitedMutex[VSHARD(Poshash)] : 0;
+        if (visited->backend() == MemoryManager::HashBackend) {
+                QMutexLocker lock( visitedMutex );
+                TREE *t = find_visited(visited, k);
+                if (t != NULL) {
+                        *node = t;
+                        return MemoryManager::FOUND;
+                }
+        }
 
-	TREELIST *tl = mm->cluster_tree(k);
-	if (tl == NULL) {
-		return MemoryManager::ERR;
-	}
+	/* Calculate indices for the new piles. */
+
+	pilesort();
 
 	/* Create a compact position representation. */
 
@@ -1049,13 +2616,21 @@ MemoryManager::inscode Solver::insert(unsigned int *cluster, int d, TREE **node)
 	if (newtree == NULL) {
 		return MemoryManager::ERR;
 	}
-        Total_generated++;
 
-        MemoryManager::inscode i2 = mm->insert_node(newtree, d, &tl->tree, node);
+        MemoryManager::inscode i2;
+        {
+                /* Another worker may have added it in the meantime, that
+                is simply FOUND then. */
+                QMutexLocker lock( visitedMutex );
+                i2 = visited->insert_visited(newtree, k, Poshash, d, node);
+        }
 
 	if (i2 != MemoryManager::NEW) {
 		mm->give_back_block((quint8 *)newtree);
 	}
+	if (i2 == MemoryManager::ERR) {
+                Status = MemoryLimitReached;
+	}
 
 	return i2;
 }
@@ -1077,24 +2652,48 @@ POSITION *Solver::new_position(POSITION *parent, MOVE *m)
 		depth = parent->depth + 1;
 	}
         MemoryManager::inscode i = insert(&cluster, depth, &node);
-        if (i == MemoryManager::NEW) {
-                Total_positions++;
-                depth_sum += depth;
-        } else
+        if (i != MemoryManager::NEW) {
             return NULL;
+        }
+
+	/* A position that can't be won any more stays in the visited set,
+	so it is passed over at once the next time, but isn't searched. */
+
+	if (parent != NULL && isDeadEnd(m)) {
+		Dead_ends++;
+		return NULL;
+	}
+        Total_positions++;
+        depth_sum += depth;
+
+	if (parent == NULL || cluster != parent->cluster) {
+		Clusters.insert(cluster);
+	}
+	if ((int)depth > Maxdepth) {
+		Maxdepth = depth;
+	}
+	if ((Total_positions & 1023) == 0) {
+		publish_stats();
+	}
 
 
 	/* A new or better position.  insert() already stashed it in the
 	tree, we just have to wrap a POSITION struct around it, and link it
 	into the move stack.  Store the temp cells after the POSITION. */
 
+	if (Freepos == NULL && m_parallel) {
+		Freepos = Returned.fetchAndStoreAcquire(0);
+	}
+	if (Freepos == NULL && mm->nearly_full()) {
+		evict_positions();
+	}
 	if (Freepos) {
 		p = (quint8 *)Freepos;
 		Freepos = Freepos->queue;
 	} else {
 		p = mm->new_from_block(Posbytes);
 		if (p == NULL) {
-                        Status = UnableToDetermineSolvability;
+                        Status = MemoryLimitReached;
 			return NULL;
 		}
 	}
@@ -1106,13 +2705,15 @@ POSITION *Solver::new_position(POSITION *parent, MOVE *m)
 	pos->move = *m;                 /* struct copy */
 	pos->cluster = cluster;
 	pos->depth = depth;
-	pos->nchild = 0;
+	pos->owner = m_worker;
+	pos->nchild.store(0);
+	pos->order = Worder;            /* from pack_position() */
 #if 0
         QString dummy;
-        quint16 *t = ( quint16* )( ( char* )node + sizeof( TREE ) );
+        quint8 *t = mm->node_key( node );
         for ( int i = 0; i < m_number_piles; ++i )
         {
-            QString s = "      " + QString( "%1" ).arg( ( int )t[i] );
+            QString s = "      " + QString( "%1" ).arg( get_pile_id( t + i * Pilewidth, Pilewidth ) );
             dummy += s.right( 5 );
         }
         if ( Total_positions % 1000 == 1000 )
@@ -1129,6 +2730,11 @@ void Solver::hash_layout(void)
 {
 	int w;
 
+	Poshash = 0;
+	for (w = 0; w < m_number_piles; w++) {
+		Whash[w] = 0;
+		Poshash += pile_mix(0, Wmix[w]);
+	}
 	for (w = 0; w < m_number_piles; w++) {
 		hashpile(w);
 	}
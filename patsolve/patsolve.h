@@ -22,15 +22,18 @@
 #include "../hint.h"
 #include "memory.h"
 
-#include "KCardPile"
-
+#include <QtCore/QAtomicPointer>
+#include <QtCore/QHash>
+#include <QtCore/QList>
 #include <QtCore/QMap>
 #include <QtCore/QMutex>
+#include <QtCore/QSet>
+#include <QtCore/QVector>
 
 #include <cstdio>
 
 
-/* A card is represented as ( down << 6 ) + (suit << 4) + rank. */
+/* A card is represented as ( down << 7 ) + (suit << 4) + rank. */
 
 typedef quint8 card_t;
 
@@ -62,11 +65,74 @@ struct POSITION {
 	MOVE move;              /* move that got us here from the parent */
 	quint32 cluster; /* the cluster this node is in */
 	short depth;            /* number of moves so far */
-	quint8 ntemp;           /* number of cards in T */
-	quint8 nchild;          /* number of child nodes left */
+	quint8 owner;           /* the worker it belongs to, see free_position() */
+	QBasicAtomicInt nchild; /* number of child nodes left */
+	quint64 order;          /* where the symmetric piles are, see pack_position() */
+};
+
+/* Every different pile gets an entry in the pile dictionary. */
+
+typedef struct bucketlist {
+	quint8 *pile;           /* packed copy of the pile, see pack_pile() */
+	quint32 hash;         /* the pile's hash code */
+	int pilenum;            /* the unique id for this pile */
+	struct bucketlist *next;
+} BUCKETLIST;
+
+/* The head of a hash bucket in the pile dictionary.  It only counts if
+gen is the dictionary's current generation, so a new generation empties
+all buckets at once. */
+
+typedef struct {
+	BUCKETLIST *list;
+	quint32 gen;
+} BUCKETHEAD;
+
+/* A shuffled deck that deals like the DealerScene does: the cards are
+created in the same order and shuffled with the same generator, so the same
+deal number gives the same layout without any card scene. */
+
+class DealDeck
+{
+public:
+    DealDeck( int dealNumber, int copies = 1, const card_t *suits = 0 );
+
+    card_t takeFirst() { return m_cards[m_first++]; }
+    card_t takeLast() { return m_cards[--m_last]; }
+    bool isEmpty() const { return m_first == m_last; }
+
+private:
+    card_t m_cards[104];
+    int m_first;
+    int m_last;
+};
+
+/* What a search has done so far.  Solver::stats() hands out a copy that
+can be taken from another thread while the search runs; it is refreshed
+every 1024 positions and once more when the search ends. */
+
+struct SolverStats
+{
+    SolverStats();
+
+    unsigned long generated;   /* positions generated */
+    unsigned long positions;   /* unique positions */
+    int clusters;              /* different clusters reached */
+    int maxDepth;
+    int piles;                 /* entries in the pile dictionary */
+    unsigned long deadEnds;    /* positions found lost by isDeadEnd() */
+    size_t memoryUsed;         /* bytes, see MemoryManager */
+    size_t memoryPeak;
+    QList<int> queued;         /* queued positions by priority */
+    qint64 setupMsecs;
+    qint64 searchMsecs;
+    qint64 cleanupMsecs;
 };
 
 class MemoryManager;
+class KCardPile;
+struct ParallelSearch;
+struct Shortcut;
 
 class Solver
 {
@@ -80,39 +146,118 @@ public:
         SolutionExists = 1
     };
 
+    /* How the positions are explored.  BestFirst serves the prioritized
+       queues of the games in round robin and goes straight on when a card
+       goes out.  The others rank a position by f, the moves made so far
+       plus the weighted number of cards still to go out, see fvalue():
+       WeightedAStar always expands the lowest f, IDAStar searches depth
+       first below a growing bound on f and BeamSearch only keeps the
+       best positions of every depth. */
+    enum Strategy
+    {
+        BestFirst,
+        WeightedAStar,
+        IDAStar,
+        BeamSearch
+    };
+
     Solver();
     virtual ~Solver();
-    ExitStatus patsolve( int max_positions = -1, bool debug = false);
+    /* With threads > 1 the search is shared by that many workers, see
+       parallel_doit().  This needs the hash backend and clone(). */
+    ExitStatus patsolve( int max_positions = -1, bool debug = false, int threads = 1 );
+    unsigned long positionsSearched() const { return Total_positions; }
+    int numberPiles() const { return m_number_piles; }
+    void setVisitedBackend( MemoryManager::Backend backend ) { mm->setBackend( backend ); }
+    /* The bytes a search may allocate, 30 MB by default.  Close to the
+       limit the search drops its worst queued positions to go on for a
+       while, and ends as MemoryLimitReached when it runs out. */
+    void setMemoryLimit( size_t bytes ) { mm->Mem_limit = bytes; }
+    size_t peakMemory() const { return mm->Mem_peak; }
+    SolverStats stats() const;
+    /* The strategy of the next patsolve().  Only BestFirst can use
+       several threads. */
+    void setStrategy( Strategy strategy ) { m_strategy = strategy; }
+    Strategy strategy() const { return m_strategy; }
+    /* The weight of the cards to go in f, in percent (default 200). */
+    void setHeuristicWeight( int percent ) { m_weight = percent; }
+    /* The positions BeamSearch keeps of every depth (default 1000). */
+    void setBeamWidth( int width ) { m_beamWidth = width; }
+    /* The weights of the move priorities, to tune them for a game, see
+       SolverTuner.  The first three are the coefficients of the queue
+       squashing function of queue_position(), the games that prioritize()
+       their moves add theirs.  setParameters() wants as many values as
+       parameters() returns and rounds the weights that are integers;
+       clone() copies them. */
+    virtual QVector<qreal> parameters() const;
+    virtual bool setParameters( const QVector<qreal> & values );
+    /* After a new solution is found, look this long for shortcuts in it,
+       see improve_solution().  0, the default, takes the first one. */
+    void setImprovementTime( int msecs ) { m_improveMsecs = msecs; }
+    /* Keep the pile dictionary and the outcome of a search until the
+       next patsolve().  A layout on the winning line, or among the
+       positions of a lost search, is answered at once.  Otherwise a lost
+       search still cuts the new one short, a won one only lends its
+       pile dictionary, see reuse_search().  A search with a position
+       budget that runs out leaves it as it was. */
+    void setRetainSearch( bool retain );
     bool recursive(POSITION *pos = 0);
+#ifdef PATSOLVE_HEADLESS
+    virtual void translate_layout() {}
+    virtual MoveHint translateMove(const MOVE & ) { return MoveHint(); }
+#else
     virtual void translate_layout() = 0;
+    virtual MoveHint translateMove(const MOVE &m ) = 0;
+#endif
+    virtual void deal_layout( int dealNumber ) = 0;
+    /* A solver for the same game and layout, to be used as search worker.
+       Returns 0 if the game can't be searched in parallel. */
+    virtual Solver *clone() const { return 0; }
     bool m_shouldEnd;
     QMutex endMutex;
-    virtual MoveHint translateMove(const MOVE &m ) = 0;
     QList<MOVE> firstMoves;
     QList<MOVE> winMoves;
 
 protected:
+    Solver( const Solver &other );
+
     MOVE *get_moves(int *nmoves);
     bool solve(POSITION *parent);
+    void init_queues();
     void doit();
+    void ida_doit();
+    int fvalue(int depth);
+    void next_beam();
+    void parallel_doit( int threads );
+    void work();
+    POSITION *steal_position();
+    POSITION *take_position();
     void win(POSITION *pos);
+    void improve_solution();
+    void retrace_line();
+    void find_shortcut(int depth, int start, QList<MOVE> &moves, Shortcut *best);
     virtual int get_possible_moves(int *a, int *numout) = 0;
     int translateSuit( int s );
 
     int wcmp(int a, int b);
     void queue_position(POSITION *pos, int pri);
     void free_position(POSITION *pos, int);
+    void evict_positions();
     POSITION *dequeue_position();
     void hashpile(int w);
     POSITION *new_position(POSITION *parent, MOVE *m);
     TREE *pack_position(void);
     void unpack_position(POSITION *pos);
+    void restore_pile(int w, int id);
     void init_buckets(void);
+    void set_pile_width(int width);
     int get_pilenum(int w);
     MemoryManager::inscode insert(unsigned int *cluster, int d, TREE **node);
+    bool layout_matches(quint8 *key);
     void free_buckets(void);
     void printcard(card_t card, FILE *outfile);
     int translate_pile(const KCardPile *pile, card_t *w, int size);
+    KCard *moved_card(const KCardPile *pile, const MOVE &m);
     virtual void print_layout();
 
     void pilesort(void);
@@ -125,11 +270,58 @@ protected:
     virtual unsigned int getClusterNumber() { return 0; }
     virtual void unpack_cluster( unsigned int  ) {}
 
+    /* Whether the layout in the work arrays can't be won any more.  Only
+       for certain: the search drops such positions, and a deal is still
+       lost if they were all it had left.  m is the move that led to the
+       layout from one that wasn't lost, or 0 if there is none. */
+    virtual bool isDeadEnd( const MOVE * ) { return false; }
+    bool frozen_cards( int first, int count, const card_t *out, bool inSuit );
+
+    /* A search of the game's own in place of doit(), for games whose
+       layouts fit into a few numbers.  It sets Status, winMoves and
+       firstMoves and returns true, or returns false to leave the layout to
+       doit(). */
+    virtual bool own_search() { return false; }
+
     void setNumberPiles( int i );
     int m_number_piles;
 
+    /* Piles the rules don't tell apart, like the free cells of Freecell.
+       Positions that only differ in the order of such piles are stored
+       as one.  Called by the constructors after setNumberPiles(). */
+    void addSymmetricPiles( int first, int count );
+
+    /* Whether the symmetric piles are interchangeable in the current
+       layout.  Not as long as the stock still deals them one card each,
+       for example. */
+    virtual bool pilesInterchangeable() { return true; }
+
+#define MAXSYM 16               /* symmetric piles in all */
+    int Nsym;                 /* groups of them */
+    int Symfirst[MAXSYM], Symcount[MAXSYM];
+    quint64 Worder;           /* see sort_symmetric() */
+    void sort_symmetric(int *ids);
+    quint64 pile_order();
+    void restore_start();
+    void translate_moves(QList<MOVE> &moves, quint64 from, quint64 to);
+
+    /* Turns the moves of a solution into the steps a scene takes, for
+       games whose moves do several things at once.  patsolve() calls it
+       on winMoves once the search is done with them, and retraces the
+       retained line along the steps. */
+    virtual void expand_moves( QList<MOVE> & ) {}
+
+    void clear_layout();
+    void deal_card( int w, card_t card, bool faceUp = true );
+
     void init();
     void free();
+    bool reuse_search();
+    bool set_aside_search();
+    void forget_search();
+    void remember_start();
+    void widen_search();
+    TREE *find_visited(MemoryManager *visited, unsigned int cluster);
 
     /* Work arrays. */
 
@@ -141,9 +333,19 @@ protected:
     quint32 *Whash;
     int *Wpilenum;
 
-    /* Position freelist. */
+    quint32 Poshash;      /* hash of the whole layout, without the cluster */
+
+    /* Symmetric piles hash as the first one of their group, and Wslot
+       counts them through all groups.  For the others Wmix is the pile
+       and Wslot is -1. */
+    int *Wmix;
+    int *Wslot;
+
+    /* Position freelist.  In a parallel search the other workers give
+       back the positions of this one they are done with on Returned. */
 
     POSITION *Freepos;
+    QAtomicPointer<POSITION> Returned;
 
 #define MAXMOVES 64             /* > max # moves from any position */
     MOVE Possible[MAXMOVES];
@@ -154,16 +356,81 @@ protected:
 #define NQUEUES 127
 
     POSITION *Qhead[NQUEUES]; /* separate queue for each priority */
+    int Qcount[NQUEUES];      /* and its length */
     int Maxq;
+    int Qpos, Minpos;         /* round robin cursor of dequeue_position() */
+    qreal Yparam[3];          /* the queue squashing function */
+    QMutex Qmutex;            /* only locked in a parallel search */
+
+    ParallelSearch *m_parallel;  /* set while this is one of several workers */
+    int m_worker;                /* and which one, see free_position() */
+
+    /* The other strategies keep their positions by f instead, each entry
+       is a stack linked through the queue member.  BeamSearch expands the
+       current depth from Beam while it fills Fqueue with the next one. */
+
+    Strategy m_strategy;
+    int m_weight;
+    int m_beamWidth;
+    QMap<int,POSITION*> Fqueue;
+    QList<POSITION*> Beam;
+    int Bound, Next_bound;    /* of the IDAStar iteration */
+    unsigned long Pruned;     /* positions BeamSearch dropped */
+
+    /* The pile dictionary.  Piles are found through their hash bucket,
+       Pilebucket is the reverse lookup for unpacking, in pages of
+       PILEPAGE ids.  The entries and the pages all live in Pilearena,
+       so the dictionary is emptied without looking at them. */
+
+    BUCKETHEAD *Bucketlist;
+    BUCKETLIST ***Pilebucket;
+    BLOCK *Pilearena;
+    quint32 Pilegen;          /* the generation of the buckets in use */
+    int Pilenum;              /* the next pile number to be assigned */
+    int Pilewidth;            /* bytes of a pile number in a position */
+    bool Widen;               /* a pile number outgrew them */
+    QVector<int> Start_piles; /* the layout to start over from */
+    unsigned int Start_cluster;
+    int Treebytes;
+    int Posbytes;
+
+    /* A search kept by setRetainSearch(): its result, the positions
+       along its winning line. */
+
+    bool m_retainSearch;
+    bool Retained;
+    ExitStatus Retained_status;
+    QList<TREE*> Winline;
+    QList<quint64> Winorder;     /* and the order of their piles */
+    QList<MOVE> Retained_moves;
+
+    int m_improveMsecs;
+    QHash<TREE*,int> Winindex;   /* where a node is on Winline */
 
     bool m_newer_piles_first;
     unsigned long Total_generated, Total_positions;
+    unsigned long Evicted;    /* queued positions dropped for memory */
+    unsigned long Dead_ends;  /* positions isDeadEnd() dropped */
+    QSet<unsigned int> Clusters;
+    int Maxdepth;
     qreal depth_sum;
 
     POSITION *Stack;
     QMap<qint32,bool> recu_pos;
     int max_positions;
     bool debug;
+
+    void publish_stats();
+    SolverStats m_stats;      /* as last published */
+    mutable QMutex statsMutex;
+
+public:
+    long all_moves;
+
+private:
+    void create();
+
+    friend class SearchWorker;
 };
 
 /* Misc. */
@@ -185,6 +452,4 @@ protected:
 #define COLOR(card) ((card) & PS_COLOR)
 #define DOWN(card) ((card) & ( 1 << 7 ) )
 
-extern long all_moves;
-
 #endif // PATSOLVE_H
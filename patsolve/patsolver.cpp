@@ -0,0 +1,223 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Command line front end for the headless solver library.  Deals and
+   solves numbered games without any card scene, theme or QApplication. */
+
+#include "batchsolver.h"
+#include "benchmark.h"
+#include "patsolve.h"
+#include "solverdatabase.h"
+#include "solverfactory.h"
+#include "solverparameters.h"
+#include "tuner.h"
+
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QThread>
+
+#include <climits>
+#include <cstdio>
+
+
+int main( int argc, char **argv )
+{
+    QCoreApplication app( argc, argv );
+    QCoreApplication::setApplicationName( QStringLiteral( "patsolver" ) );
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription( QStringLiteral( "Solve numbered KPatience deals" ) );
+    parser.addHelpOption();
+    parser.addPositionalArgument( QStringLiteral( "game" ), QStringLiteral( "Game id to solve, as for kpat --solve" ) );
+    parser.addOption( QCommandLineOption( QStringList() << QStringLiteral( "start" ), QStringLiteral( "Game range start (default 1)" ), QStringLiteral( "num" ) ) );
+    parser.addOption( QCommandLineOption( QStringList() << QStringLiteral( "end" ), QStringLiteral( "Game range end (default start)" ), QStringLiteral( "num" ) ) );
+    parser.addOption( QCommandLineOption( QStringList() << QStringLiteral( "jobs" ), QStringLiteral( "Number of deals to solve in parallel (default: one per core)" ), QStringLiteral( "num" ) ) );
+    parser.addOption( QCommandLineOption( QStringList() << QStringLiteral( "threads" ), QStringLiteral( "Number of threads searching each deal (default 1)" ), QStringLiteral( "num" ) ) );
+    parser.addOption( QCommandLineOption( QStringList() << QStringLiteral( "memory" ), QStringLiteral( "Memory budget of every search in MB (default 30)" ), QStringLiteral( "mb" ) ) );
+    parser.addOption( QCommandLineOption( QStringList() << QStringLiteral( "stats" ), QStringLiteral( "Write the statistics of every search as JSON to file" ), QStringLiteral( "file" ) ) );
+    parser.addOption( QCommandLineOption( QStringList() << QStringLiteral( "strategy" ), QStringLiteral( "Search strategy, \"best\" (default), \"astar\", \"ida\" or \"beam\"" ), QStringLiteral( "name" ) ) );
+    parser.addOption( QCommandLineOption( QStringList() << QStringLiteral( "weight" ), QStringLiteral( "Weight of the cards to go for astar, ida and beam in percent (default 200)" ), QStringLiteral( "percent" ) ) );
+    parser.addOption( QCommandLineOption( QStringList() << QStringLiteral( "beam-width" ), QStringLiteral( "Positions the beam search keeps of every depth (default 1000)" ), QStringLiteral( "num" ) ) );
+    parser.addOption( QCommandLineOption( QStringList() << QStringLiteral( "improve" ), QStringLiteral( "Time to spend shortening every solution found (default 0)" ), QStringLiteral( "msecs" ) ) );
+    parser.addOption( QCommandLineOption( QStringList() << QStringLiteral( "database" ), QStringLiteral( "Take known deals from this solver database and add the others to it" ), QStringLiteral( "file" ) ) );
+    parser.addOption( QCommandLineOption( QStringList() << QStringLiteral( "solutions" ), QStringLiteral( "Write the outcome and solution of every deal to file, for kpat to replay" ), QStringLiteral( "file" ) ) );
+    parser.addOption( QCommandLineOption( QStringList() << QStringLiteral( "visited" ), QStringLiteral( "Visited position store, \"hash\" (default) or \"tree\"" ), QStringLiteral( "backend" ) ) );
+    parser.addOption( QCommandLineOption( QStringList() << QStringLiteral( "parameters" ), QStringLiteral( "Take the weights of the solver from file, see --tune" ), QStringLiteral( "file" ) ) );
+    parser.addOption( QCommandLineOption( QStringList() << QStringLiteral( "tune" ), QStringLiteral( "Tune the weights of the solver on the deals instead of solving them, and store them in the --parameters file" ) ) );
+    parser.addOption( QCommandLineOption( QStringList() << QStringLiteral( "budget" ), QStringLiteral( "Positions every deal may search while tuning (default 20000)" ), QStringLiteral( "num" ) ) );
+    parser.addOption( QCommandLineOption( QStringList() << QStringLiteral( "rounds" ), QStringLiteral( "Rounds of tuning every weight (default 5)" ), QStringLiteral( "num" ) ) );
+    parser.addOption( QCommandLineOption( QStringList() << QStringLiteral( "testdir" ), QStringLiteral( "Solve the test cases of kpat --testdir --generate in this directory instead of a game" ), QStringLiteral( "directory" ) ) );
+    parser.addOption( QCommandLineOption( QStringList() << QStringLiteral( "results" ), QStringLiteral( "Write the results of the test cases as JSON to file" ), QStringLiteral( "file" ) ) );
+    parser.addOption( QCommandLineOption( QStringList() << QStringLiteral( "baseline" ), QStringLiteral( "Fail if the test cases got slower or changed their verdict since the results in file" ), QStringLiteral( "file" ) ) );
+    parser.addOption( QCommandLineOption( QStringList() << QStringLiteral( "threshold" ), QStringLiteral( "Percentage a game may get slower than the baseline (default 20)" ), QStringLiteral( "percent" ) ) );
+    parser.process( app );
+
+    if ( parser.isSet( "testdir" ) )
+    {
+        SolverBenchmark benchmark( parser.value( "testdir" ) );
+        if ( parser.isSet( "jobs" ) )
+            benchmark.setJobs( parser.value( "jobs" ).toInt() );
+        if ( parser.isSet( "results" ) )
+            benchmark.setResultsFile( parser.value( "results" ) );
+        if ( parser.isSet( "baseline" ) )
+        {
+            int threshold = 20;
+            if ( parser.isSet( "threshold" ) )
+                threshold = qMax( 0, parser.value( "threshold" ).toInt() );
+            benchmark.setBaseline( parser.value( "baseline" ), threshold );
+        }
+        return benchmark.run() == 0 ? 0 : 1;
+    }
+
+    if ( parser.positionalArguments().size() != 1 )
+        parser.showHelp( 1 );
+
+    bool ok = false;
+    const int gameId = parser.positionalArguments().first().toInt( &ok );
+    if ( !ok )
+        parser.showHelp( 1 );
+
+    int start = 1;
+    if ( parser.isSet( "start" ) )
+        start = qMax( 1, parser.value( "start" ).toInt() );
+    int end = start;
+    if ( parser.isSet( "end" ) )
+        end = qBound( start, parser.value( "end" ).toInt(), INT_MAX );
+
+    int jobs = QThread::idealThreadCount();
+    if ( parser.isSet( "jobs" ) )
+        jobs = parser.value( "jobs" ).toInt();
+    jobs = qMax( 1, jobs );
+
+    int threads = 1;
+    if ( parser.isSet( "threads" ) )
+        threads = qMax( 1, parser.value( "threads" ).toInt() );
+
+    size_t memoryLimit = 0;
+    if ( parser.isSet( "memory" ) )
+        memoryLimit = size_t( qMax( 1, parser.value( "memory" ).toInt() ) ) * 1000 * 1000;
+
+    MemoryManager::Backend backend = MemoryManager::HashBackend;
+    if ( parser.isSet( "visited" ) )
+    {
+        const QString name = parser.value( "visited" );
+        if ( name == QLatin1String( "tree" ) )
+            backend = MemoryManager::TreeBackend;
+        else if ( name != QLatin1String( "hash" ) )
+        {
+            fprintf( stderr, "Unknown visited backend %s\n", qPrintable( name ) );
+            return 1;
+        }
+    }
+
+    Solver::Strategy strategy = Solver::BestFirst;
+    if ( parser.isSet( "strategy" ) )
+    {
+        const QString name = parser.value( "strategy" );
+        if ( name == QLatin1String( "astar" ) )
+            strategy = Solver::WeightedAStar;
+        else if ( name == QLatin1String( "ida" ) )
+            strategy = Solver::IDAStar;
+        else if ( name == QLatin1String( "beam" ) )
+            strategy = Solver::BeamSearch;
+        else if ( name != QLatin1String( "best" ) )
+        {
+            fprintf( stderr, "Unknown strategy %s\n", qPrintable( name ) );
+            return 1;
+        }
+    }
+
+    int baseId;
+    QString options;
+    solverDatabaseKey( gameId, &baseId, &options );
+
+    SolverParameters parameters;
+    const QString parametersFile = parser.value( "parameters" );
+    if ( !parametersFile.isEmpty() && !parameters.load( parametersFile ) && !parser.isSet( "tune" ) )
+    {
+        fprintf( stderr, "Can't read %s\n", qPrintable( parametersFile ) );
+        return 1;
+    }
+
+    if ( parser.isSet( "tune" ) )
+    {
+        SolverTuner tuner( gameId, start, end );
+        tuner.setJobs( jobs );
+        if ( parser.isSet( "budget" ) )
+            tuner.setBudget( parser.value( "budget" ).toInt() );
+        if ( parser.isSet( "rounds" ) )
+            tuner.setRounds( parser.value( "rounds" ).toInt() );
+        if ( parameters.contains( baseId, options ) )
+            tuner.setValues( parameters.values( baseId, options ) );
+        if ( !tuner.run() )
+            return 1;
+
+        if ( !parametersFile.isEmpty() )
+        {
+            parameters.setValues( baseId, options, tuner.values() );
+            if ( !parameters.save( parametersFile ) )
+                return 1;
+        }
+        return 0;
+    }
+
+    QList<Solver*> solvers;
+    for ( int i = 0; i < jobs; ++i )
+    {
+        Solver *solver = createSolver( gameId );
+        if ( !solver )
+        {
+            fprintf( stderr, "There is no solver for game %d\n", gameId );
+            return 1;
+        }
+        solver->setVisitedBackend( backend );
+        solver->setStrategy( strategy );
+        if ( parser.isSet( "weight" ) )
+            solver->setHeuristicWeight( qMax( 0, parser.value( "weight" ).toInt() ) );
+        if ( parser.isSet( "beam-width" ) )
+            solver->setBeamWidth( qMax( 1, parser.value( "beam-width" ).toInt() ) );
+        if ( parser.isSet( "improve" ) )
+            solver->setImprovementTime( qMax( 0, parser.value( "improve" ).toInt() ) );
+        if ( memoryLimit )
+            solver->setMemoryLimit( memoryLimit );
+        if ( !parameters.apply( baseId, options, solver ) )
+        {
+            fprintf( stderr, "The parameters in %s don't fit the solver of game %d\n", qPrintable( parametersFile ), gameId );
+            return 1;
+        }
+        solvers << solver;
+    }
+
+    BatchSolver batch( solvers, start, end );
+    batch.setSearchThreads( threads );
+    if ( parser.isSet( "stats" ) )
+        batch.setStatsFile( parser.value( "stats" ) );
+
+    batch.setGame( baseId, options );
+
+    SolverDatabase *database = 0;
+    if ( parser.isSet( "database" ) )
+    {
+        database = new SolverDatabase( parser.value( "database" ) );
+        batch.setDatabase( database );
+    }
+    if ( parser.isSet( "solutions" ) )
+        batch.setSolutionFile( parser.value( "solutions" ) );
+    batch.run();
+
+    delete database;
+    qDeleteAll( solvers );
+    return 0;
+}
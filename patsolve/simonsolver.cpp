@@ -17,7 +17,9 @@
 
 #include "simonsolver.h"
 
+#ifndef PATSOLVE_HEADLESS
 #include "../simon.h"
+#endif
 
 #include <QDebug>
 
@@ -46,14 +48,14 @@ void SimonSolver::make_move(MOVE *m)
 	to = m->to;
 
 	if (m->totype == O_Type) {
-            O[to] = SUIT( *Wp[from] );
+            O[to] = SUIT( *Wp[from] ) << 4;
             Wlen[from] -= 13;
             Wp[from] -= 13;
-            hashpile( from );
             if ( Wlen[from] && DOWN( *Wp[from] ) )
             {
                 *Wp[from] = ( SUIT( *Wp[from] ) << 4 ) + RANK( *Wp[from] );
             }
+            hashpile( from );
 #if PRINT
             print_layout();
 #endif
@@ -356,9 +358,31 @@ SimonSolver::SimonSolver(const Simon *dealer)
     : Solver()
 {
     setNumberPiles( 10 );
+    addSymmetricPiles( 0, 10 );
     deal = dealer;
 }
 
+/* Deal like Simon::restart(). */
+
+void SimonSolver::deal_layout( int dealNumber )
+{
+    DealDeck cards( dealNumber );
+
+    clear_layout();
+    for ( int piles = 9; piles >= 3; --piles )
+        for ( int j = 0; j < piles; ++j )
+            deal_card( j, cards.takeLast() );
+
+    for ( int j = 0; j < 10; ++j )
+        deal_card( j, cards.takeLast() );
+
+    Q_ASSERT( cards.isEmpty() );
+
+    for ( int i = 0; i < 4; ++i )
+        O[i] = -1;
+}
+
+#ifndef PATSOLVE_HEADLESS
 /* Read a layout file.  Format is one pile per line, bottom to top (visible
 card).  Temp cells and Out on the last two lines, if any. */
 
@@ -383,6 +407,7 @@ void SimonSolver::translate_layout()
         }
     }
 }
+#endif
 
 unsigned int SimonSolver::getClusterNumber()
 {
@@ -416,12 +441,16 @@ void SimonSolver::print_layout()
     fprintf(stderr, "\nprint-layout-end\n");
 }
 
+#ifndef PATSOLVE_HEADLESS
 MoveHint SimonSolver::translateMove( const MOVE &m )
 {
-    Q_ASSERT( m.from < 10 && m.to < 10 );
+    if ( m.from >= 10 || ( m.totype == W_Type && m.to >= 10 ) )
+        return MoveHint();
 
     PatPile *frompile = deal->store[m.from];
-    KCard *card = frompile->at( frompile->count() - m.card_index - 1);
+    KCard *card = moved_card( frompile, m );
+    if ( !card )
+        return MoveHint();
 
     if ( m.totype == O_Type )
     {
@@ -430,6 +459,6 @@ MoveHint SimonSolver::translateMove( const MOVE &m )
                 return MoveHint( card, deal->target[i], 127 );
     }
 
-    Q_ASSERT( m.to < 10 );
     return MoveHint( card, deal->store[m.to], m.pri );
 }
+#endif
@@ -32,9 +32,13 @@ public:
     virtual void undo_move(MOVE *m);
     virtual int getOuts();
     virtual unsigned int getClusterNumber();
-    virtual void translate_layout();
     virtual void unpack_cluster( unsigned int k );
+    virtual void deal_layout( int dealNumber );
+    virtual Solver *clone() const { return new SimonSolver( *this ); }
+#ifndef PATSOLVE_HEADLESS
+    virtual void translate_layout();
     virtual MoveHint translateMove(const MOVE &m);
+#endif
 
     virtual void print_layout();
 
@@ -0,0 +1,193 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "solutionfile.h"
+
+#include <cstdlib>
+#include <cstring>
+
+
+static const char MAGIC[] = "kpat-solutions";
+static const int VERSION = 1;
+
+
+QByteArray SolutionFile::header( int gameId, const QString & options )
+{
+    QByteArray line = MAGIC;
+    line += ' ';
+    line += QByteArray::number( VERSION );
+    line += ' ';
+    line += QByteArray::number( gameId );
+    if ( !options.isEmpty() )
+    {
+        line += ' ';
+        line += options.toUtf8();
+    }
+    line += '\n';
+    return line;
+}
+
+
+/* Reads a number at *p and moves *p past it. */
+
+static bool parseNumber( const char ** p, int * number )
+{
+    char *end;
+    const long value = strtol( *p, &end, 10 );
+    if ( end == *p )
+        return false;
+    *number = int( value );
+    *p = end;
+    return true;
+}
+
+
+static const char * skipSpaces( const char * p )
+{
+    while ( *p == ' ' || *p == '\t' )
+        ++p;
+    return p;
+}
+
+
+static bool isEndOfLine( const char * p )
+{
+    return *p == '\0' || *p == '\n' || *p == '\r';
+}
+
+
+bool SolutionFile::parseHeader( const QByteArray & line, int * gameId, QString * options )
+{
+    const char *p = line.constData();
+    if ( strncmp( p, MAGIC, strlen( MAGIC ) ) != 0 )
+        return false;
+    p = skipSpaces( p + strlen( MAGIC ) );
+
+    int version;
+    if ( !parseNumber( &p, &version ) || version != VERSION )
+        return false;
+    p = skipSpaces( p );
+    if ( !parseNumber( &p, gameId ) )
+        return false;
+    p = skipSpaces( p );
+
+    const char *end = p;
+    while ( !isEndOfLine( end ) && *end != ' ' )
+        ++end;
+    *options = QString::fromUtf8( p, int( end - p ) );
+    return true;
+}
+
+
+QByteArray SolutionFile::dealLine( const Deal & deal )
+{
+    QByteArray line = QByteArray::number( deal.dealNumber );
+    if ( deal.status == Solver::SolutionExists )
+    {
+        line += " won";
+        foreach ( const MOVE & m, deal.moves )
+        {
+            line += ' ';
+            line += QByteArray::number( m.from );
+            if ( m.card_index != 0 )
+            {
+                line += '+';
+                line += QByteArray::number( m.card_index );
+            }
+            line += '>';
+            if ( m.totype == O_Type )
+                line += 'o';
+            line += QByteArray::number( m.to );
+            if ( m.turn_index != -1 )
+            {
+                line += '^';
+                line += QByteArray::number( m.turn_index );
+            }
+        }
+    }
+    else if ( deal.status == Solver::NoSolutionExists )
+        line += " lost";
+    else
+        line += " unknown";
+    line += '\n';
+    return line;
+}
+
+
+bool SolutionFile::parseDealLine( const QByteArray & line, int piles, Deal * deal )
+{
+    const char *p = skipSpaces( line.constData() );
+    if ( !parseNumber( &p, &deal->dealNumber ) )
+        return false;
+    p = skipSpaces( p );
+
+    deal->moves.clear();
+    if ( strncmp( p, "lost", 4 ) == 0 )
+    {
+        deal->status = Solver::NoSolutionExists;
+        return true;
+    }
+    if ( strncmp( p, "unknown", 7 ) == 0 )
+    {
+        deal->status = Solver::UnableToDetermineSolvability;
+        return true;
+    }
+    if ( strncmp( p, "won", 3 ) != 0 )
+        return false;
+    deal->status = Solver::SolutionExists;
+
+    p = skipSpaces( p + 3 );
+    while ( !isEndOfLine( p ) )
+    {
+        MOVE m;
+        int from;
+        if ( !parseNumber( &p, &from ) || from < 0 || from >= piles )
+            return false;
+        m.from = from;
+        m.card_index = 0;
+        if ( *p == '+' )
+        {
+            ++p;
+            if ( !parseNumber( &p, &m.card_index ) || m.card_index < 0 )
+                return false;
+        }
+        if ( *p++ != '>' )
+            return false;
+        m.totype = W_Type;
+        if ( *p == 'o' )
+        {
+            ++p;
+            m.totype = O_Type;
+        }
+        /* A foundation number is the solver's own business, Clock
+        has more foundations than piles. */
+        int to;
+        if ( !parseNumber( &p, &to ) || to < 0 || to > 255
+             || ( m.totype == W_Type && to >= piles ) )
+            return false;
+        m.to = to;
+        m.turn_index = -1;
+        if ( *p == '^' )
+        {
+            ++p;
+            if ( !parseNumber( &p, &m.turn_index ) || m.turn_index < -1 )
+                return false;
+        }
+        m.pri = 0;
+        deal->moves.append( m );
+        p = skipSpaces( p );
+    }
+    return true;
+}
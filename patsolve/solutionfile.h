@@ -0,0 +1,63 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SOLUTIONFILE_H
+#define SOLUTIONFILE_H
+
+#include "patsolve.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+#include <QtCore/QString>
+
+
+/* Solutions as text, one line per deal, so a file can be written while the
+   deals are solved and read back one line at a time.  The first line names
+   the game as DealerScene::gameId() and getGameOptions() do:
+
+       kpat-solutions 1 <game id> [<options>]
+
+   Then every line is a deal:
+
+       <deal number> won <move> <move> ...
+       <deal number> lost
+       <deal number> unknown
+
+   The moves are the MOVEs of the game's solver, which the solver of a scene
+   turns into cards and piles with translateMove() when it replays them.  A
+   move is its from pile, "+" and the card index unless that is 0, ">" and
+   the to pile, which has an "o" in front when it is a foundation, and "^"
+   and the turn index unless that is -1, e.g. "3>o0", "2+4>7" or "6>1^0".
+   parseDealLine() rejects the moves from or to piles the solver doesn't
+   have, given how many it has.  Whether a move fits the layout is up to
+   the replay. */
+class SolutionFile
+{
+public:
+    struct Deal
+    {
+        int dealNumber;
+        int status;         /* a Solver::ExitStatus */
+        QList<MOVE> moves;
+    };
+
+    static QByteArray header( int gameId, const QString & options );
+    static bool parseHeader( const QByteArray & line, int * gameId, QString * options );
+
+    static QByteArray dealLine( const Deal & deal );
+    static bool parseDealLine( const QByteArray & line, int piles, Deal * deal );
+};
+
+#endif // SOLUTIONFILE_H
@@ -0,0 +1,469 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "solverdatabase.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QSaveFile>
+#include <QtCore/QtEndian>
+
+#include <cstdio>
+#include <cstring>
+
+
+/* The file is little endian throughout:
+
+   header   "KPSD", version, number of options, number of records,
+            all quint32
+   options  the different game options, sorted, each a quint16 length and
+            that many bytes of UTF-8, padded to a multiple of four bytes
+            at the end
+   records  RECORD_SIZE bytes each, sorted by game id, option index and
+            deal number:
+                quint16 game id
+                quint16 option index
+                qint32  deal number
+                quint32 positions searched
+                quint32 first move in the moves
+                quint16 number of moves
+                qint8   status
+                quint8  unused
+   moves    MOVE_SIZE bytes each: card index, from, to, totype and turn
+            index, the latter signed.
+
+   Since the options are sorted, the records are sorted by the options'
+   strings as well, which lets save() merge two files without decoding
+   more than one record of each at a time. */
+
+static const char MAGIC[4] = { 'K', 'P', 'S', 'D' };
+static const quint32 VERSION = 2;     /* 1 had Golf deals lost that aren't */
+static const int HEADER_SIZE = 16;
+static const int RECORD_SIZE = 20;
+static const int MOVE_SIZE = 5;
+static const int MAX_MOVES = 0xffff;    /* what the record can count */
+
+
+SolverDatabase::Entry::Entry()
+  : status( Solver::UnableToDetermineSolvability ),
+    positions( 0 )
+{
+}
+
+
+bool SolverDatabase::Entry::isDecided() const
+{
+    return status == Solver::SolutionExists || status == Solver::NoSolutionExists;
+}
+
+
+/* Whether entry is worth more than old, see insert(). */
+
+static bool replaces( const SolverDatabase::Entry & entry, const SolverDatabase::Entry & old )
+{
+    if ( !entry.isDecided() )
+        return !old.isDecided() && entry.positions > old.positions;
+    if ( !old.isDecided() )
+        return true;
+    return entry.status == Solver::SolutionExists
+           && old.status == Solver::SolutionExists
+           && entry.moves.count() < old.moves.count();
+}
+
+
+bool SolverDatabase::Key::operator<( const Key & other ) const
+{
+    if ( gameId != other.gameId )
+        return gameId < other.gameId;
+    if ( options != other.options )
+        return options < other.options;
+    return dealNumber < other.dealNumber;
+}
+
+
+SolverDatabase::SolverDatabase( const QString & fileName )
+  : m_fileName( fileName ),
+    m_file( fileName ),
+    m_data( 0 ),
+    m_size( 0 ),
+    m_records( 0 ),
+    m_recordCount( 0 ),
+    m_moves( 0 ),
+    m_movesSize( 0 )
+{
+    map();
+}
+
+
+SolverDatabase::~SolverDatabase()
+{
+    unmap();
+}
+
+
+/* Maps the file and sets up the views into it.  A missing file is an
+   empty database; so is a broken one, which save() then replaces. */
+
+bool SolverDatabase::map()
+{
+    if ( !m_file.exists() || !m_file.open( QIODevice::ReadOnly ) )
+        return false;
+
+    m_size = m_file.size();
+    if ( m_size >= HEADER_SIZE )
+        m_data = m_file.map( 0, m_size );
+    if ( !m_data || memcmp( m_data, MAGIC, 4 ) != 0
+         || qFromLittleEndian<quint32>( m_data + 4 ) != VERSION )
+    {
+        fprintf( stderr, "Ignoring %s, it is no solver database\n", qPrintable( m_fileName ) );
+        unmap();
+        return false;
+    }
+
+    const quint32 optionCount = qFromLittleEndian<quint32>( m_data + 8 );
+    const quint32 recordCount = qFromLittleEndian<quint32>( m_data + 12 );
+
+    qint64 offset = HEADER_SIZE;
+    for ( quint32 i = 0; i < optionCount; ++i )
+    {
+        if ( offset + 2 > m_size )
+            break;
+        const int length = qFromLittleEndian<quint16>( m_data + offset );
+        offset += 2;
+        if ( offset + length > m_size )
+            break;
+        const QString options = QString::fromUtf8( reinterpret_cast<const char *>( m_data + offset ), length );
+        offset += length;
+        m_optionIds.insert( options, m_options.count() );
+        m_options << options;
+    }
+    offset = ( offset + 3 ) & ~qint64( 3 );
+
+    if ( quint32( m_options.count() ) != optionCount
+         || offset + qint64( recordCount ) * RECORD_SIZE > m_size )
+    {
+        fprintf( stderr, "Ignoring %s, it is truncated\n", qPrintable( m_fileName ) );
+        unmap();
+        return false;
+    }
+
+    m_records = m_data + offset;
+    m_recordCount = recordCount;
+    offset += qint64( recordCount ) * RECORD_SIZE;
+    m_moves = m_data + offset;
+    m_movesSize = m_size - offset;
+    return true;
+}
+
+
+void SolverDatabase::unmap()
+{
+    if ( m_data )
+        m_file.unmap( const_cast<uchar *>( m_data ) );
+    m_file.close();
+
+    m_data = 0;
+    m_size = 0;
+    m_options.clear();
+    m_optionIds.clear();
+    m_records = 0;
+    m_recordCount = 0;
+    m_moves = 0;
+    m_movesSize = 0;
+}
+
+
+SolverDatabase::Key SolverDatabase::recordKey( int record ) const
+{
+    const uchar *r = m_records + qint64( record ) * RECORD_SIZE;
+
+    Key key;
+    key.gameId = qFromLittleEndian<quint16>( r );
+    key.options = m_options.value( qFromLittleEndian<quint16>( r + 2 ) );
+    key.dealNumber = qFromLittleEndian<qint32>( r + 4 );
+    return key;
+}
+
+
+SolverDatabase::Entry SolverDatabase::recordEntry( int record ) const
+{
+    const uchar *r = m_records + qint64( record ) * RECORD_SIZE;
+
+    Entry entry;
+    entry.positions = qFromLittleEndian<quint32>( r + 8 );
+    entry.status = qint8( r[18] );
+
+    const qint64 first = qFromLittleEndian<quint32>( r + 12 );
+    const int count = qFromLittleEndian<quint16>( r + 16 );
+    if ( ( first + count ) * MOVE_SIZE > m_movesSize )
+    {
+        // Keep the outcome, but a cut off solution is of no use.
+        if ( entry.status == Solver::SolutionExists )
+            entry.status = Solver::UnableToDetermineSolvability;
+        return entry;
+    }
+
+    const uchar *p = m_moves + first * MOVE_SIZE;
+    entry.moves.reserve( count );
+    for ( int i = 0; i < count; ++i, p += MOVE_SIZE )
+    {
+        MOVE m;
+        m.card_index = p[0];
+        m.from = p[1];
+        m.to = p[2];
+        m.totype = PileType( p[3] );
+        m.pri = 0;
+        m.turn_index = qint8( p[4] );
+        entry.moves.append( m );
+    }
+    return entry;
+}
+
+
+/* Binary search of the mapped records, returns -1 if key isn't there. */
+
+int SolverDatabase::findRecord( const Key & key ) const
+{
+    const int option = m_optionIds.value( key.options, -1 );
+    if ( option < 0 )
+        return -1;
+
+    int low = 0;
+    int high = m_recordCount;
+    while ( low < high )
+    {
+        const int mid = low + ( high - low ) / 2;
+        const uchar *r = m_records + qint64( mid ) * RECORD_SIZE;
+        const quint16 gameId = qFromLittleEndian<quint16>( r );
+        const int o = qFromLittleEndian<quint16>( r + 2 );
+        const qint32 dealNumber = qFromLittleEndian<qint32>( r + 4 );
+
+        if ( gameId == key.gameId && o == option && dealNumber == key.dealNumber )
+            return mid;
+        if ( gameId < key.gameId
+             || ( gameId == key.gameId && ( o < option
+                                            || ( o == option && dealNumber < key.dealNumber ) ) ) )
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return -1;
+}
+
+
+bool SolverDatabase::lookup( int gameId, const QString & options, int dealNumber, Entry * entry ) const
+{
+    Key key;
+    key.gameId = gameId;
+    key.options = options;
+    key.dealNumber = dealNumber;
+
+    QMutexLocker lock( &m_mutex );
+
+    QMap<Key,Entry>::const_iterator it = m_pending.constFind( key );
+    if ( it != m_pending.constEnd() )
+    {
+        *entry = it.value();
+        return true;
+    }
+
+    const int record = findRecord( key );
+    if ( record < 0 )
+        return false;
+    *entry = recordEntry( record );
+    return true;
+}
+
+
+void SolverDatabase::insert( int gameId, const QString & options, int dealNumber, const Entry & _entry )
+{
+    Key key;
+    key.gameId = gameId;
+    key.options = options;
+    key.dealNumber = dealNumber;
+
+    // A solution the file can't hold is as good as none.
+    Entry entry = _entry;
+    if ( entry.status == Solver::SolutionExists && entry.moves.count() > MAX_MOVES )
+    {
+        entry.status = Solver::UnableToDetermineSolvability;
+        entry.moves.clear();
+    }
+
+    QMutexLocker lock( &m_mutex );
+
+    QMap<Key,Entry>::const_iterator it = m_pending.constFind( key );
+    if ( it != m_pending.constEnd() )
+    {
+        if ( !replaces( entry, it.value() ) )
+            return;
+    }
+    else
+    {
+        const int record = findRecord( key );
+        if ( record >= 0 && !replaces( entry, recordEntry( record ) ) )
+            return;
+    }
+    m_pending.insert( key, entry );
+}
+
+
+static void appendLittleEndian16( QByteArray & data, quint16 value )
+{
+    uchar buffer[2];
+    qToLittleEndian<quint16>( value, buffer );
+    data.append( reinterpret_cast<const char *>( buffer ), 2 );
+}
+
+
+static void appendLittleEndian32( QByteArray & data, quint32 value )
+{
+    uchar buffer[4];
+    qToLittleEndian<quint32>( value, buffer );
+    data.append( reinterpret_cast<const char *>( buffer ), 4 );
+}
+
+
+/* Only one save runs at a time.  The file is merged and written while
+   lookup() and insert() go on, m_mutex is only held to take a copy of the
+   pending results and to put the new file in place of the mapped one. */
+
+bool SolverDatabase::save()
+{
+    QMutexLocker saveLock( &m_saveMutex );
+
+    QMap<Key,Entry> pending;
+    {
+        QMutexLocker lock( &m_mutex );
+        pending = m_pending;
+    }
+    if ( pending.isEmpty() )
+        return true;
+
+    QSaveFile file( m_fileName );
+    {
+        // Start from what is on disk now.
+        const SolverDatabase disk( m_fileName );
+
+        QStringList options = disk.m_options;
+        for ( QMap<Key,Entry>::const_iterator it = pending.constBegin(); it != pending.constEnd(); ++it )
+            if ( !disk.m_optionIds.contains( it.key().options ) && !options.contains( it.key().options ) )
+                options << it.key().options;
+        options.sort();
+
+        QHash<QString,int> optionIds;
+        for ( int i = 0; i < options.count(); ++i )
+            optionIds.insert( options.at( i ), i );
+
+        QByteArray records;
+        QByteArray moves;
+        quint32 moveCount = 0;
+        quint32 recordCount = 0;
+
+        QMap<Key,Entry>::const_iterator it = pending.constBegin();
+        int record = 0;
+        while ( record < disk.m_recordCount || it != pending.constEnd() )
+        {
+            Key key;
+            Entry entry;
+            if ( it == pending.constEnd()
+                 || ( record < disk.m_recordCount && disk.recordKey( record ) < it.key() ) )
+            {
+                key = disk.recordKey( record );
+                entry = disk.recordEntry( record );
+                ++record;
+            }
+            else
+            {
+                key = it.key();
+                entry = it.value();
+                if ( record < disk.m_recordCount && !( key < disk.recordKey( record ) ) )
+                {
+                    // The same deal, someone may have done better meanwhile.
+                    const Entry old = disk.recordEntry( record );
+                    if ( !replaces( entry, old ) )
+                        entry = old;
+                    ++record;
+                }
+                ++it;
+            }
+
+            if ( entry.status != Solver::SolutionExists )
+                entry.moves.clear();
+            const int count = entry.moves.count();
+
+            appendLittleEndian16( records, key.gameId );
+            appendLittleEndian16( records, optionIds.value( key.options ) );
+            appendLittleEndian32( records, quint32( key.dealNumber ) );
+            appendLittleEndian32( records, quint32( qMin<unsigned long>( entry.positions, 0xffffffffUL ) ) );
+            appendLittleEndian32( records, moveCount );
+            appendLittleEndian16( records, count );
+            records.append( char( entry.status ) );
+            records.append( char( 0 ) );
+            ++recordCount;
+
+            for ( int i = 0; i < count; ++i )
+            {
+                const MOVE & m = entry.moves.at( i );
+                moves.append( char( m.card_index ) );
+                moves.append( char( m.from ) );
+                moves.append( char( m.to ) );
+                moves.append( char( m.totype ) );
+                moves.append( char( m.turn_index ) );
+            }
+            moveCount += count;
+        }
+
+        QByteArray data( MAGIC, 4 );
+        appendLittleEndian32( data, VERSION );
+        appendLittleEndian32( data, options.count() );
+        appendLittleEndian32( data, recordCount );
+        foreach ( const QString & option, options )
+        {
+            const QByteArray utf8 = option.toUtf8();
+            appendLittleEndian16( data, utf8.size() );
+            data.append( utf8 );
+        }
+        while ( data.size() % 4 )
+            data.append( char( 0 ) );
+        data.append( records );
+        data.append( moves );
+
+        if ( !file.open( QIODevice::WriteOnly ) || file.write( data ) != data.size() )
+        {
+            fprintf( stderr, "Can't write %s\n", qPrintable( m_fileName ) );
+            return false;
+        }
+    }
+
+    QMutexLocker lock( &m_mutex );
+
+    // The old file must not be mapped while it is replaced.
+    unmap();
+    const bool saved = file.commit();
+    if ( saved )
+    {
+        // Keep what was inserted in the meantime and is better.
+        for ( QMap<Key,Entry>::const_iterator it = pending.constBegin(); it != pending.constEnd(); ++it )
+            if ( !replaces( m_pending.value( it.key() ), it.value() ) )
+                m_pending.remove( it.key() );
+    }
+    else
+    {
+        fprintf( stderr, "Can't write %s\n", qPrintable( m_fileName ) );
+    }
+
+    map();
+    return saved;
+}
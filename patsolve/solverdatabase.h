@@ -0,0 +1,103 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SOLVERDATABASE_H
+#define SOLVERDATABASE_H
+
+#include "patsolve.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMap>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+
+/* The outcome of earlier searches, keyed by game id, game options (see
+   DealerScene::getGameOptions()) and deal number.  The file is mapped into
+   memory and its records are searched in place, so a lookup costs a
+   binary search however many deals the file knows.  New results are kept
+   aside until save() merges them into the file, which is then written
+   anew.  All members may be called from several threads, and lookups and
+   inserts don't wait for a save to write the file. */
+class SolverDatabase
+{
+public:
+    struct Entry
+    {
+        Entry();
+
+        int status;               /* a Solver::ExitStatus */
+        unsigned long positions;  /* positions searched */
+        QList<MOVE> moves;        /* the solution if status is SolutionExists */
+
+        bool isDecided() const;
+    };
+
+    explicit SolverDatabase( const QString & fileName );
+    ~SolverDatabase();
+
+    QString fileName() const { return m_fileName; }
+
+    /* Fills in entry and returns true if the deal is in the database. */
+    bool lookup( int gameId, const QString & options, int dealNumber, Entry * entry ) const;
+
+    /* Records the outcome of a search.  A won or lost deal is never
+       replaced by an undecided one, a solution only by a shorter one.  A
+       solution of more than 65535 moves counts as undecided. */
+    void insert( int gameId, const QString & options, int dealNumber, const Entry & entry );
+
+    /* Merges what was inserted since into the file as it is on disk now,
+       so another process writing the file in the meantime loses nothing
+       but deals both solved. */
+    bool save();
+
+private:
+    struct Key
+    {
+        quint16 gameId;
+        QString options;
+        qint32 dealNumber;
+
+        bool operator<( const Key & other ) const;
+    };
+
+    bool map();
+    void unmap();
+    int findRecord( const Key & key ) const;
+    Key recordKey( int record ) const;
+    Entry recordEntry( int record ) const;
+
+    QString m_fileName;
+    QFile m_file;
+    const uchar * m_data;
+    qint64 m_size;
+
+    /* Views into the mapped file, see solverdatabase.cpp. */
+    QStringList m_options;
+    QHash<QString,int> m_optionIds;
+    const uchar * m_records;
+    int m_recordCount;
+    const uchar * m_moves;
+    qint64 m_movesSize;
+
+    QMap<Key,Entry> m_pending;
+    mutable QMutex m_mutex;
+    QMutex m_saveMutex;     /* held by save() throughout */
+};
+
+#endif // SOLVERDATABASE_H
@@ -0,0 +1,111 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "solverfactory.h"
+
+#include "../dealerinfo.h"
+#include "clocksolver.h"
+#include "fortyeightsolver.h"
+#include "freecellsolver.h"
+#include "golfsolver.h"
+#include "grandfsolver.h"
+#include "gypsysolver.h"
+#include "idiotsolver.h"
+#include "klondikesolver.h"
+#include "mod3solver.h"
+#include "simonsolver.h"
+#include "spidersolver.h"
+#include "yukonsolver.h"
+
+#include <QtCore/QString>
+
+
+Solver *createSolver( int gameId )
+{
+    // The general ids get the defaults from kpat.kcfg.
+    switch ( gameId )
+    {
+    case DealerInfo::KlondikeDrawOneId:
+    case DealerInfo::KlondikeGeneralId:
+        return new KlondikeSolver( 0, 1 );
+    case DealerInfo::KlondikeDrawThreeId:
+        return new KlondikeSolver( 0, 3 );
+    case DealerInfo::GrandfatherId:
+        return new GrandfSolver( 0 );
+    case DealerInfo::AcesUpId:
+        return new IdiotSolver( 0 );
+    case DealerInfo::FreecellId:
+        return new FreecellSolver( 0 );
+    case DealerInfo::Mod3Id:
+        return new Mod3Solver( 0 );
+    case DealerInfo::GypsyId:
+        return new GypsySolver( 0 );
+    case DealerInfo::FortyAndEightId:
+        return new FortyeightSolver( 0 );
+    case DealerInfo::SimpleSimonId:
+        return new SimonSolver( 0 );
+    case DealerInfo::YukonId:
+        return new YukonSolver( 0 );
+    case DealerInfo::GrandfathersClockId:
+        return new ClockSolver( 0 );
+    case DealerInfo::GolfId:
+        return new GolfSolver( 0 );
+    case DealerInfo::SpiderOneSuitId:
+        return new SpiderSolver( 0, 1 );
+    case DealerInfo::SpiderTwoSuitId:
+    case DealerInfo::SpiderGeneralId:
+        return new SpiderSolver( 0, 2 );
+    case DealerInfo::SpiderFourSuitId:
+        return new SpiderSolver( 0, 4 );
+    default:
+        return 0;
+    }
+}
+
+
+void solverDatabaseKey( int gameId, int *baseId, QString *options )
+{
+    *baseId = gameId;
+    options->clear();
+
+    // Only Klondike and Spider have options, see their getGameOptions().
+    switch ( gameId )
+    {
+    case DealerInfo::KlondikeDrawOneId:
+    case DealerInfo::KlondikeGeneralId:
+        *baseId = DealerInfo::KlondikeGeneralId;
+        *options = QStringLiteral( "1" );
+        break;
+    case DealerInfo::KlondikeDrawThreeId:
+        *baseId = DealerInfo::KlondikeGeneralId;
+        *options = QStringLiteral( "3" );
+        break;
+    case DealerInfo::SpiderOneSuitId:
+        *baseId = DealerInfo::SpiderGeneralId;
+        *options = QStringLiteral( "1" );
+        break;
+    case DealerInfo::SpiderTwoSuitId:
+    case DealerInfo::SpiderGeneralId:
+        *baseId = DealerInfo::SpiderGeneralId;
+        *options = QStringLiteral( "2" );
+        break;
+    case DealerInfo::SpiderFourSuitId:
+        *baseId = DealerInfo::SpiderGeneralId;
+        *options = QStringLiteral( "4" );
+        break;
+    default:
+        break;
+    }
+}
@@ -0,0 +1,33 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SOLVERFACTORY_H
+#define SOLVERFACTORY_H
+
+class QString;
+class Solver;
+
+
+/* Create a solver for a DealerInfo game id that is not attached to any
+   scene.  Feed it with Solver::deal_layout() instead of translate_layout().
+   Returns 0 if the game has no solver. */
+Solver *createSolver( int gameId );
+
+/* The game id and options that a scene playing the game of createSolver()
+   reports through gameId() and getGameOptions(), the key of the game in a
+   SolverDatabase. */
+void solverDatabaseKey( int gameId, int *baseId, QString *options );
+
+#endif // SOLVERFACTORY_H
@@ -0,0 +1,115 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "solverparameters.h"
+
+#include "patsolve.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QList>
+#include <QtCore/QSaveFile>
+
+#include <cstdio>
+
+
+QByteArray SolverParameters::key( int gameId, const QString & options )
+{
+    QByteArray k = QByteArray::number( gameId );
+    if ( !options.isEmpty() )
+    {
+        k += '/';
+        k += options.toUtf8();
+    }
+    return k;
+}
+
+
+bool SolverParameters::load( const QString & fileName )
+{
+    QFile file( fileName );
+    if ( !file.open( QIODevice::ReadOnly ) )
+        return false;
+
+    while ( !file.atEnd() )
+    {
+        const QByteArray line = file.readLine().simplified();
+        if ( line.isEmpty() || line.startsWith( '#' ) )
+            continue;
+
+        const QList<QByteArray> fields = line.split( ' ' );
+        QVector<qreal> values;
+        bool ok = true;
+        for ( int i = 1; ok && i < fields.size(); ++i )
+            values << fields.at( i ).toDouble( &ok );
+        if ( !ok || values.isEmpty() )
+        {
+            fprintf( stderr, "Ignoring the parameters of %s in %s\n", fields.first().constData(), qPrintable( fileName ) );
+            continue;
+        }
+        m_values.insert( fields.first(), values );
+    }
+    return true;
+}
+
+
+bool SolverParameters::save( const QString & fileName ) const
+{
+    QByteArray data;
+    for ( QMap<QByteArray,QVector<qreal> >::const_iterator it = m_values.constBegin(); it != m_values.constEnd(); ++it )
+    {
+        data += it.key();
+        foreach ( qreal value, it.value() )
+        {
+            data += ' ';
+            data += QByteArray::number( value, 'g', 6 );
+        }
+        data += '\n';
+    }
+
+    QSaveFile file( fileName );
+    const bool saved = file.open( QIODevice::WriteOnly )
+                       && file.write( data ) == data.size()
+                       && file.commit();
+    if ( !saved )
+        fprintf( stderr, "Can't write %s\n", qPrintable( fileName ) );
+    return saved;
+}
+
+
+bool SolverParameters::contains( int gameId, const QString & options ) const
+{
+    return m_values.contains( key( gameId, options ) );
+}
+
+
+QVector<qreal> SolverParameters::values( int gameId, const QString & options ) const
+{
+    return m_values.value( key( gameId, options ) );
+}
+
+
+void SolverParameters::setValues( int gameId, const QString & options, const QVector<qreal> & values )
+{
+    m_values.insert( key( gameId, options ), values );
+}
+
+
+bool SolverParameters::apply( int gameId, const QString & options, Solver * solver ) const
+{
+    QMap<QByteArray,QVector<qreal> >::const_iterator it = m_values.constFind( key( gameId, options ) );
+    if ( it == m_values.constEnd() )
+        return true;
+    return solver->setParameters( it.value() );
+}
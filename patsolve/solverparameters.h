@@ -0,0 +1,56 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SOLVERPARAMETERS_H
+#define SOLVERPARAMETERS_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QMap>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+class Solver;
+
+
+/* Tuned weights for the solvers of some games, see Solver::parameters().
+   The file has a line per game:
+
+       <game id>[/<options>] <value> <value> ...
+
+   with the game id and options of DealerScene::gameId() and
+   getGameOptions(), as solverDatabaseKey() gives them.  Empty lines and
+   lines starting with # are skipped, and save() doesn't keep them. */
+class SolverParameters
+{
+public:
+    /* Adds the games of the file.  Returns false if it can't be read. */
+    bool load( const QString & fileName );
+    bool save( const QString & fileName ) const;
+
+    bool contains( int gameId, const QString & options ) const;
+    QVector<qreal> values( int gameId, const QString & options ) const;
+    void setValues( int gameId, const QString & options, const QVector<qreal> & values );
+
+    /* Hands the values of the game to the solver, if there are any.
+       Returns false if they don't fit its parameters. */
+    bool apply( int gameId, const QString & options, Solver * solver ) const;
+
+private:
+    static QByteArray key( int gameId, const QString & options );
+
+    QMap<QByteArray,QVector<qreal> > m_values;
+};
+
+#endif // SOLVERPARAMETERS_H
@@ -17,7 +17,9 @@
 
 #include "spidersolver.h"
 
+#ifndef PATSOLVE_HEADLESS
 #include "../spider.h"
+#endif
 
 #include <QDebug>
 
@@ -47,33 +49,30 @@ void SpiderSolver::make_move(MOVE *m)
 
         if ( m->from >= 10 )
         {
-            Q_ASSERT( Wlen[from] == 10 );
+            Q_ASSERT( from == 10 + m_redeal );
             for ( int i = 0; i < 10; ++i )
             {
-                card_t card = *Wp[from];
-                card = ( SUIT( card ) << 4 ) + RANK( card );
+                card_t card = m_redeals[m_redeal][9 - i];
                 ++Wp[i];
                 *Wp[i] = card;
-                --Wp[from];
                 Wlen[i]++;
                 hashpile( i );
             }
-            Wlen[from] = 0;
-            hashpile( from );
+            m_redeal++;
 #if PRINT
             print_layout();
 #endif
             return;
         }
 	if (m->totype == O_Type) {
-            O[to] = SUIT( *Wp[from] );
+            O[to] = SUIT( *Wp[from] ) << 4;
             Wlen[from] -= 13;
             Wp[from] -= 13;
-            hashpile( from );
             if ( Wlen[from] && DOWN( *Wp[from] ) )
             {
                 *Wp[from] = ( SUIT( *Wp[from] ) << 4 ) + RANK( *Wp[from] );
             }
+            hashpile( from );
 #if PRINT
             print_layout();
 #endif
@@ -134,20 +133,14 @@ void SpiderSolver::undo_move(MOVE *m)
 
         if ( m->from >= 10 )
         {
-            Q_ASSERT( Wlen[from] == 0 );
-            for ( int i = 0; i < 10; ++i )
+            m_redeal--;
+            Q_ASSERT( from == 10 + m_redeal );
+            for ( int i = 9; i >= 0; --i )
             {
-                card_t card = *Wp[i];
-                Q_ASSERT( !DOWN( card ) );
-                card = ( SUIT( card ) << 4 ) + RANK( card ) + ( 1 << 7 );
-                ++Wp[from];
                 --Wp[i];
-                *Wp[from] = card;
-                Wlen[from]++;
                 Wlen[i]--;
                 hashpile( i );
             }
-            hashpile( from );
 #if PRINT
             print_layout();
 #endif
@@ -245,7 +238,7 @@ int SpiderSolver::get_possible_moves(int *a, int *numout)
             mp->from = w;
             int o = 0;
             while ( O[o] != -1 )
-                o++; // TODO I need a way to tell spades off from heart off
+                o++;
             mp->to = o;
             mp->totype = O_Type;
             mp->pri = 128;
@@ -345,7 +338,8 @@ int SpiderSolver::get_possible_moves(int *a, int *numout)
                         printcard( card, stderr );
                         fprintf( stderr, "%d %d %d %d %d\n", i, j, conti[i], conti[j],l );
 #endif
-                        if ( SUIT( card ) != SUIT( *Wp[j] ) )
+                        // don't break up a run but onto its own suit
+                        if ( !Wlen[j] || SUIT( card ) != SUIT( *Wp[j] ) )
                         {
 			  //fprintf( stderr, "continue %d %d %d %d\n",conti[j]+l, conti[i],conti[j]+l, SUIT( card ) != SUIT( *Wp[j] ) );
                             continue;
@@ -383,8 +377,9 @@ int SpiderSolver::get_possible_moves(int *a, int *numout)
                         else {
                             if ( conti[j]+l+1 != 13 || conti[i]>conti[j]+l )
                             {
-                                card_t card_below = W[i][Wlen[i]-l-2];
-                                if ( SUIT( card_below ) != SUIT( card ) || RANK(card_below) != RANK(card) + 1 )
+                                // moving the whole pile leaves no card below
+                                card_t card_below = Wlen[i] > l+1 ? W[i][Wlen[i]-l-2] : NONE;
+                                if ( card_below == NONE || SUIT( card_below ) != SUIT( card ) || RANK(card_below) != RANK(card) + 1 )
                                 {
                                     foundgood = true;
                                 } else {
@@ -432,18 +427,15 @@ int SpiderSolver::get_possible_moves(int *a, int *numout)
     }
 
     /* check for redeal */
-    for ( int i = 0; i < 5; ++i ) {
-        if ( !Wlen[10+i] || foundgood )
-            continue;
+    if ( m_redeal < 5 && !foundgood ) {
         mp->card_index = 0;
-        mp->from = 10+i;
+        mp->from = 10 + m_redeal;
         mp->to = 0; // unused
         mp->totype = W_Type;
         mp->pri = 0;
         mp->turn_index = -1;
         n++;
         mp++;
-        break; // one is enough
     }
 
     if ( n > toomuch && foundgood)
@@ -478,16 +470,19 @@ int SpiderSolver::get_possible_moves(int *a, int *numout)
     return n;
 }
 
+/* The legs in the order of the suits.  Which leg a run went to doesn't
+matter, only how many runs of every suit are out. */
+
 void SpiderSolver::unpack_cluster( unsigned int k )
 {
-    // TODO: this only works for easy
-    for ( unsigned int i = 0; i < 8; ++i )
-    {
-        if ( i < k )
-            O[i] = PS_SPADE;
-        else
-            O[i] = -1;
-    }
+    m_redeal = k >> 16;
+
+    int o = 0;
+    for ( int s = 0; s < 4; ++s )
+        for ( unsigned int i = ( k >> ( 4 * s ) ) & 0xF; i > 0; --i )
+            O[o++] = s << 4;
+    while ( o < 8 )
+        O[o++] = -1;
 }
 
 bool SpiderSolver::isWon()
@@ -512,14 +507,46 @@ int SpiderSolver::getOuts()
     return k / 2;
 }
 
-SpiderSolver::SpiderSolver(const Spider *dealer)
-    : Solver()
+SpiderSolver::SpiderSolver(const Spider *dealer, int suits, bool stackFaceup)
+    : Solver(), m_redeal( 0 ), m_suits( suits ), m_stackFaceup( stackFaceup )
 {
-    // 10 play + 5 redeals
-    setNumberPiles( 15 );
+    // 10 play, the redeals are kept apart
+    setNumberPiles( 10 );
     deal = dealer;
 }
 
+/* Deal like Spider::restart().  Like Spider::createDeck(), always pass
+four suits so the game numbering stays the same. */
+
+void SpiderSolver::deal_layout( int dealNumber )
+{
+    static const card_t oneSuit[4] = { PS_SPADE, PS_SPADE, PS_SPADE, PS_SPADE };
+    static const card_t twoSuits[4] = { PS_HEART, PS_SPADE, PS_HEART, PS_SPADE };
+    static const card_t fourSuits[4] = { PS_CLUB, PS_DIAMOND, PS_HEART, PS_SPADE };
+    DealDeck cards( dealNumber, 2, m_suits == 1 ? oneSuit : m_suits == 2 ? twoSuits : fourSuits );
+
+    clear_layout();
+    int column = 0;
+    for ( int i = 0; i < 44; ++i )
+    {
+        deal_card( column, cards.takeLast(), m_stackFaceup );
+        column = ( column + 1 ) % 10;
+    }
+    for ( int i = 0; i < 10; ++i )
+    {
+        deal_card( column, cards.takeLast() );
+        column = ( column + 1 ) % 10;
+    }
+    for ( int column = 0; column < 5; ++column )
+        for ( int i = 0; i < 10; ++i )
+            m_redeals[column][i] = cards.takeLast();
+    m_redeal = 0;
+
+    for ( int i = 0; i < 8; ++i )
+        O[i] = -1;
+}
+
+#ifndef PATSOLVE_HEADLESS
 /* Read a layout file.  Format is one pile per line, bottom to top (visible
 card).  Temp cells and Out on the last two lines, if any. */
 
@@ -535,10 +562,18 @@ void SpiderSolver::translate_layout()
         total += i;
     }
 
+    /* The scene deals the redeals in order, the ones dealt are empty. */
+    m_redeal = 0;
     for ( int w = 0; w < 5; ++w ) {
-        int i = translate_pile( deal->redeals[w], W[10+w], 52 );
-        Wp[10+w] = &W[10+w][i-1];
-        Wlen[10+w] = i;
+        card_t cards[52];
+        int i = translate_pile( deal->redeals[w], cards, 52 );
+        if ( !i && m_redeal == w ) {
+            m_redeal++;
+            continue;
+        }
+        Q_ASSERT( i == 10 );
+        for ( int j = 0; j < 10; ++j )
+            m_redeals[w][j] = ( SUIT( cards[j] ) << 4 ) + RANK( cards[j] );
         total += i;
     }
 
@@ -551,13 +586,18 @@ void SpiderSolver::translate_layout()
         }
     }
 }
+#endif
+
+/* The runs out of every suit, four bits each, and the rows dealt from the
+stock above them.  The stock never changes but for the rows dealt, so it
+isn't part of the piles of a position. */
 
 unsigned int SpiderSolver::getClusterNumber()
 {
-    unsigned int k = 0;
+    unsigned int k = m_redeal << 16;
     for ( int i = 0; i < 8; ++i )
         if ( O[i] != -1 )
-            k++;
+            k += 1 << ( 4 * SUIT( O[i] ) );
     return k;
 }
 
@@ -566,17 +606,21 @@ void SpiderSolver::print_layout()
     int i, w, o;
 
     fprintf(stderr, "print-layout-begin\n");
-    for (w = 0; w < 15; ++w) {
+    for (w = 0; w < 10; ++w) {
         Q_ASSERT( Wp[w] == &W[w][Wlen[w]-1] );
-        if ( w < 10 )
-            fprintf( stderr, "Play%d: ", w );
-        else
-            fprintf( stderr, "Deal%d: ", w-10 );
+        fprintf( stderr, "Play%d: ", w );
         for (i = 0; i < Wlen[w]; ++i) {
             printcard(W[w][i], stderr);
         }
         fputc('\n', stderr);
     }
+    for (w = m_redeal; w < 5; ++w) {
+        fprintf( stderr, "Deal%d: ", w );
+        for (i = 0; i < 10; ++i) {
+            printcard(m_redeals[w][i] + ( 1 << 7 ), stderr);
+        }
+        fputc('\n', stderr);
+    }
     fprintf( stderr, "Off: " );
     for (o = 0; o < 8; ++o) {
         if ( O[o] != -1 )
@@ -586,6 +630,7 @@ void SpiderSolver::print_layout()
     return;
 }
 
+#ifndef PATSOLVE_HEADLESS
 MoveHint SpiderSolver::translateMove( const MOVE &m )
 {
     if ( m.from >= 10 )
@@ -599,10 +644,13 @@ MoveHint SpiderSolver::translateMove( const MOVE &m )
         return MoveHint( frompile->topCard(), deal->legs[0], m.pri ); // for now
     }
 
-    Q_ASSERT( m.from < 10 && m.to < 10 );
+    if ( m.to >= 10 )
+        return MoveHint();
 
-    KCard *card = frompile->at( frompile->count() - m.card_index - 1);
+    KCard *card = moved_card( frompile, m );
+    if ( !card )
+        return MoveHint();
 
-    Q_ASSERT( m.to < 10 );
     return MoveHint( card, deal->stack[m.to], m.pri );
 }
+#endif
@@ -25,16 +25,20 @@ class Spider;
 class SpiderSolver : public Solver
 {
 public:
-    SpiderSolver(const Spider *dealer);
+    SpiderSolver(const Spider *dealer, int suits = 2, bool stackFaceup = false);
     virtual int get_possible_moves(int *a, int *numout);
     virtual bool isWon();
     virtual void make_move(MOVE *m);
     virtual void undo_move(MOVE *m);
     virtual int getOuts();
     virtual unsigned int getClusterNumber();
-    virtual void translate_layout();
     virtual void unpack_cluster( unsigned int k );
+    virtual void deal_layout( int dealNumber );
+    virtual Solver *clone() const { return new SpiderSolver( *this ); }
+#ifndef PATSOLVE_HEADLESS
+    virtual void translate_layout();
     virtual MoveHint translateMove(const MOVE &m);
+#endif
 
     virtual void print_layout();
 
@@ -42,6 +46,15 @@ public:
 
     int O[8];
     const Spider *deal;
+
+    /* The rows still in the stock, the next one to deal is m_redeal.
+       Their cards are face up already, the top one goes to pile 0. */
+    card_t m_redeals[5][10];
+    int m_redeal;
+
+    /* Only used by deal_layout(), the scene knows better. */
+    int m_suits;
+    bool m_stackFaceup;
 };
 
 #endif // SPIDERSOLVER_H
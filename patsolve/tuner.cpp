@@ -0,0 +1,201 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tuner.h"
+
+#include "patsolve.h"
+#include "solverfactory.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QThread>
+
+#include <cstdio>
+
+
+class SolverTunerThread : public QThread
+{
+public:
+    SolverTunerThread( SolverTuner * tuner, Solver * solver )
+      : m_tuner( tuner ),
+        m_solver( solver ),
+        m_cost( 0 )
+    {
+    }
+
+    virtual void run()
+    {
+        int dealNumber;
+        while ( m_tuner->nextDeal( &dealNumber ) )
+        {
+            m_solver->deal_layout( dealNumber );
+            const Solver::ExitStatus status = m_solver->patsolve( m_tuner->m_budget );
+            if ( status == Solver::SolutionExists || status == Solver::NoSolutionExists )
+                m_cost += m_solver->positionsSearched();
+            else
+                m_cost += 2 * quint64( m_tuner->m_budget );
+        }
+    }
+
+    quint64 cost() const { return m_cost; }
+
+private:
+    SolverTuner * m_tuner;
+    Solver * m_solver;
+    quint64 m_cost;
+};
+
+
+static QByteArray valuesText( const QVector<qreal> & values )
+{
+    QByteArray text;
+    foreach ( qreal value, values )
+    {
+        if ( !text.isEmpty() )
+            text += ' ';
+        text += QByteArray::number( value, 'g', 6 );
+    }
+    return text;
+}
+
+
+SolverTuner::SolverTuner( int gameId, int start, int end )
+  : m_gameId( gameId ),
+    m_start( start ),
+    m_end( end ),
+    m_jobs( 1 ),
+    m_budget( 20000 ),
+    m_rounds( 5 ),
+    m_cost( 0 ),
+    m_cursor( 0 )
+{
+}
+
+
+SolverTuner::~SolverTuner()
+{
+    qDeleteAll( m_solvers );
+}
+
+
+bool SolverTuner::nextDeal( int * dealNumber )
+{
+    const int next = m_cursor.fetchAndAddOrdered( 1 );
+    if ( next > m_end - m_start )
+        return false;
+    *dealNumber = m_start + next;
+    return true;
+}
+
+
+/* The weights as the solver keeps them, rounded where it wants integers,
+   or nothing if they don't fit. */
+
+QVector<qreal> SolverTuner::normalized( const QVector<qreal> & values ) const
+{
+    Solver *solver = m_solvers.first();
+    if ( !solver->setParameters( values ) )
+        return QVector<qreal>();
+    return solver->parameters();
+}
+
+
+quint64 SolverTuner::evaluate( const QVector<qreal> & values )
+{
+    QList<SolverTunerThread*> threads;
+    foreach ( Solver * solver, m_solvers )
+    {
+        solver->setParameters( values );
+        threads << new SolverTunerThread( this, solver );
+    }
+
+    m_cursor.store( 0 );
+    foreach ( SolverTunerThread * thread, threads )
+        thread->start();
+
+    quint64 cost = 0;
+    foreach ( SolverTunerThread * thread, threads )
+    {
+        thread->wait();
+        cost += thread->cost();
+    }
+    qDeleteAll( threads );
+    return cost;
+}
+
+
+bool SolverTuner::run()
+{
+    qDeleteAll( m_solvers );
+    m_solvers.clear();
+    for ( int i = 0; i < m_jobs; ++i )
+    {
+        Solver *solver = createSolver( m_gameId );
+        if ( !solver )
+        {
+            fprintf( stderr, "There is no solver for game %d\n", m_gameId );
+            return false;
+        }
+        m_solvers << solver;
+    }
+
+    if ( m_values.isEmpty() )
+        m_values = m_solvers.first()->parameters();
+    m_values = normalized( m_values );
+    if ( m_values.isEmpty() )
+    {
+        fprintf( stderr, "The parameters don't fit the solver of game %d\n", m_gameId );
+        return false;
+    }
+
+    m_cost = evaluate( m_values );
+    fprintf( stdout, "start: %llu positions, %s\n", ( unsigned long long )m_cost, valuesText( m_values ).constData() );
+
+    QVector<qreal> steps;
+    foreach ( qreal value, m_values )
+        steps << ( value != 0 ? qAbs( value ) / 2 : 1 );
+
+    for ( int round = 1; round <= m_rounds; ++round )
+    {
+        for ( int i = 0; i < m_values.size(); ++i )
+        {
+            bool moved = false;
+            for ( int direction = 1; !moved && direction >= -1; direction -= 2 )
+            {
+                // Go on in a direction that paid off.
+                forever
+                {
+                    QVector<qreal> candidate = m_values;
+                    candidate[i] += direction * steps[i];
+                    candidate = normalized( candidate );
+                    if ( candidate.isEmpty() || candidate == m_values )
+                        break;
+
+                    const quint64 cost = evaluate( candidate );
+                    if ( cost >= m_cost )
+                        break;
+
+                    m_values = candidate;
+                    m_cost = cost;
+                    moved = true;
+                    fprintf( stdout, "  %llu positions, %s\n", ( unsigned long long )m_cost, valuesText( m_values ).constData() );
+                }
+            }
+            if ( !moved )
+                steps[i] /= 2;
+        }
+        fprintf( stdout, "round %d: %llu positions, %s\n", round, ( unsigned long long )m_cost, valuesText( m_values ).constData() );
+    }
+    return true;
+}
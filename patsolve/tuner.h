@@ -0,0 +1,81 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TUNER_H
+#define TUNER_H
+
+class Solver;
+class SolverTunerThread;
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QList>
+#include <QtCore/QVector>
+
+
+/* Tunes the weights of a game's solver, see Solver::parameters(), so that
+   it searches as few positions as it can to decide a range of deals.  A
+   deal may search a budget of positions, one that isn't decided by then
+   costs twice the budget.  The tuning is a coordinate descent: every round
+   moves each weight up or down by its step for as long as that lowers the
+   cost, and halves the step of a weight that didn't move.  The deals of
+   every try are solved in parallel. */
+class SolverTuner
+{
+public:
+    SolverTuner( int gameId, int start, int end );
+    ~SolverTuner();
+
+    /* Solve this many deals in parallel (default 1). */
+    void setJobs( int jobs ) { m_jobs = qMax( 1, jobs ); }
+
+    /* The positions every deal may search (default 20000). */
+    void setBudget( int positions ) { m_budget = qMax( 1, positions ); }
+
+    /* How often every weight is tried (default 5). */
+    void setRounds( int rounds ) { m_rounds = qMax( 1, rounds ); }
+
+    /* Start from these weights instead of the defaults of the solver. */
+    void setValues( const QVector<qreal> & values ) { m_values = values; }
+
+    /* Returns false if the game has no solver or the weights to start
+       from don't fit it. */
+    bool run();
+
+    /* The best weights found and the positions they cost. */
+    QVector<qreal> values() const { return m_values; }
+    quint64 cost() const { return m_cost; }
+
+private:
+    QVector<qreal> normalized( const QVector<qreal> & values ) const;
+    quint64 evaluate( const QVector<qreal> & values );
+    bool nextDeal( int * dealNumber );
+
+    int m_gameId;
+    int m_start;
+    int m_end;
+    int m_jobs;
+    int m_budget;
+    int m_rounds;
+
+    QVector<qreal> m_values;
+    quint64 m_cost;
+
+    QList<Solver*> m_solvers;
+    QAtomicInt m_cursor;
+
+    friend class SolverTunerThread;
+};
+
+#endif // TUNER_H
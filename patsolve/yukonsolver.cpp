@@ -17,7 +17,9 @@
 
 #include "yukonsolver.h"
 
+#ifndef PATSOLVE_HEADLESS
 #include "../yukon.h"
+#endif
 
 #include <QDebug>
 
@@ -338,6 +340,16 @@ int YukonSolver::getOuts()
     return O[0] + O[1] + O[2] + O[3];
 }
 
+/* See Solver::frozen_cards().  Turning a card can only thaw others, it
+takes a card going out to freeze any. */
+
+bool YukonSolver::isDeadEnd( const MOVE *m )
+{
+    if ( m && m->totype != O_Type )
+        return false;
+    return frozen_cards( 0, 7, O, false );
+}
+
 YukonSolver::YukonSolver(const Yukon *dealer)
     : Solver()
 {
@@ -347,9 +359,27 @@ YukonSolver::YukonSolver(const Yukon *dealer)
     Osuit[3] = PS_SPADE;
 
     setNumberPiles( 7 );
+    addSymmetricPiles( 0, 7 );
     deal = dealer;
 }
 
+/* Deal like Yukon::restart(). */
+
+void YukonSolver::deal_layout( int dealNumber )
+{
+    DealDeck cards( dealNumber );
+
+    clear_layout();
+    for ( int round = 0; round < 11; ++round )
+        for ( int j = 0; j < 7; ++j )
+            if ( ( j == 0 && round == 0 ) || ( j && round < j + 5 ) )
+                deal_card( j, cards.takeLast(), round >= j || j == 0 );
+
+    for ( int i = 0; i < 4; ++i )
+        O[i] = NONE;
+}
+
+#ifndef PATSOLVE_HEADLESS
 /* Read a layout file.  Format is one pile per line, bottom to top (visible
 card).  Temp cells and Out on the last two lines, if any. */
 
@@ -380,6 +410,7 @@ void YukonSolver::translate_layout()
     }
     Q_ASSERT( total == 52 );
 }
+#endif
 
 unsigned int YukonSolver::getClusterNumber()
 {
@@ -390,12 +421,18 @@ unsigned int YukonSolver::getClusterNumber()
     return k;
 }
 
+#ifndef PATSOLVE_HEADLESS
 MoveHint YukonSolver::translateMove( const MOVE &m )
 {
+    if ( m.from >= 7 || ( m.totype == W_Type && m.to >= 7 ) )
+        return MoveHint();
+
     PatPile *frompile = 0;
     frompile = deal->store[m.from];
 
-    KCard *card = frompile->at( frompile->count() - m.card_index - 1);
+    KCard *card = moved_card( frompile, m );
+    if ( !card )
+        return MoveHint();
 
     if ( m.totype == O_Type )
     {
@@ -419,6 +456,7 @@ MoveHint YukonSolver::translateMove( const MOVE &m )
         return MoveHint( card, deal->store[m.to], m.pri );
     }
 }
+#endif
 
 void YukonSolver::print_layout()
 {
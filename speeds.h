@@ -38,4 +38,16 @@ const qreal AUTODROP_SPEEDUP_FACTOR = 0.90;
 
 const int TIME_BETWEEN_MOVES =  SPEED_FACTOR * 250;
 
+// How long a replay shows a won deal before it deals the next one.
+const int TIME_BETWEEN_REPLAYS = SPEED_FACTOR * 2000;
+
+// How long the solver may take to check a move or find hints.
+const int DURATION_SOLVER_DEADLINE = 2000;
+
+// How long the solver may spend shortening a solution it found.
+const int DURATION_SOLVER_IMPROVE = 300;
+
+// How long the solver database waits for more results before it is saved.
+const int DURATION_SOLVER_DATABASE_SAVE = 10000;
+
 #endif
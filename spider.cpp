@@ -303,6 +303,13 @@ void Spider::setGameOptions( const QString & options )
 }
 
 
+QString Spider::getSolverOptions() const
+{
+    // Face up stacks make more deals winnable.
+    return m_stackFaceup ? getGameOptions() + QLatin1String(",faceup") : getGameOptions();
+}
+
+
 void Spider::restart( const QList<KCard*> & cards )
 {
     m_pilesWithRuns.clear();
@@ -57,6 +57,7 @@ protected:
     virtual QString getGameState() const;
     virtual void setGameState( const QString & state );
     virtual QString getGameOptions() const;
+    virtual QString getSolverOptions() const;
     virtual void setGameOptions( const QString & options );
     virtual bool checkAdd(const PatPile * pile, const QList<KCard*> & oldCards, const QList<KCard*> & newCards) const;
     virtual bool checkRemove(const PatPile * pile, const QList<KCard*> & cards) const;